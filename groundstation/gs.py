@@ -1,17 +1,153 @@
 import sys
+import os
 import json
+import time
+import base64
+import zlib
 import serial
 import serial.tools.list_ports
 from PyQt5.QtWidgets import *
 from PyQt5.QtCore import *
 from PyQt5.QtGui import *
 
+class LogDownloader:
+    """Resumable log download over the FC's GET command.
+
+    Each DAT line carries its file offset and the CRC32 of its bytes. A bad
+    or out of order line, or a stalled link, re-requests the file from the
+    last good offset. Partial downloads are kept as <name>.part and resume
+    where they stopped, also across sessions."""
+
+    STALL_S = 2.0
+
+    def __init__(self, send, report, out_dir="downloads"):
+        self.send = send      # sends one command line to the FC
+        self.report = report  # progress and status text
+        self.out_dir = out_dir
+        self.name = None
+
+    @property
+    def active(self):
+        return self.name is not None
+
+    def start(self, name):
+        os.makedirs(self.out_dir, exist_ok=True)
+        self.name = name
+        self.part = os.path.join(self.out_dir, name + ".part")
+        self.file = open(self.part, "ab")
+        self.offset = self.file.tell()
+        self.size = None
+        self.resumes = 0
+        self.bad_lines = 0
+        self.t_start = self.t_last = time.monotonic()
+        self.bytes_start = self.offset
+        self.request()
+
+    def request(self):
+        # Lines already in flight are ignored until the FC acknowledges
+        self.syncing = True
+        self.t_last = time.monotonic()
+        self.send(f"GET {self.name} {self.offset}")
+
+    def resume(self):
+        self.resumes += 1
+        self.request()
+
+    def cancel(self):
+        if self.active:
+            self.send("GET")
+            self.file.close()
+            self.report(f"Download of {self.name} cancelled at {self.offset} bytes, rerun to resume")
+            self.name = None
+
+    def poll(self):
+        if self.active and time.monotonic() - self.t_last > self.STALL_S:
+            self.resume()
+
+    def feed(self, line):
+        """Returns True if the line belonged to the download."""
+        if line.startswith("DAT:"):
+            if self.active:
+                self.on_data(line)
+            return True
+        if line.startswith("GET:") and self.active:
+            self.on_status(line.split())
+            return True
+        return False
+
+    def on_status(self, parts):
+        if len(parts) == 4 and parts[1] == self.name:
+            self.size = int(parts[2])
+            if self.offset > self.size:
+                # The .part can't be a prefix of this file, it was left by an
+                # older file of the same name (card wiped since), so start over
+                self.report(f"{self.part} is {self.offset} bytes but the FC file is {self.size}, restarting")
+                self.file.truncate(0)
+                self.offset = self.bytes_start = 0
+                self.request()
+                return
+            self.syncing = int(parts[3]) != self.offset
+            self.t_last = time.monotonic()
+        elif parts[1] == "END" and parts[2] == self.name and not self.syncing:
+            if self.offset == self.size:
+                self.finish(int(parts[4]))
+            else:
+                self.resume()
+        elif parts[1] == "ERROR" and parts[2:] == [self.name]:
+            # The answer to our own GET, so it counts while syncing too
+            self.report(f"FC could not open {self.name} (missing, or still being logged), {self.offset} bytes kept")
+            self.file.close()
+            self.name = None
+        elif parts[1] == "ABORT" and not self.syncing:
+            self.report(f"FC stopped the download ({parts[1]}), {self.offset} bytes kept")
+            self.file.close()
+            self.name = None
+
+    def on_data(self, line):
+        try:
+            _, off, b64, crc = line.split(" ")
+            off, crc = int(off), int(crc, 16)
+            data = base64.b64decode(b64, validate=True)
+        except ValueError:
+            off, data, crc = -1, b"", 0
+
+        if self.syncing or off < self.offset:
+            return
+        if off > self.offset:  # a line went missing
+            self.resume()
+            return
+        if zlib.crc32(data) != crc:
+            self.bad_lines += 1
+            self.resume()
+            return
+
+        self.file.write(data)
+        self.offset += len(data)
+        self.t_last = time.monotonic()
+        if self.size:
+            self.report(None, self.offset * 100 // self.size)
+
+    def finish(self, fc_ms):
+        self.file.close()
+        final = os.path.join(self.out_dir, self.name)
+        os.replace(self.part, final)
+
+        secs = time.monotonic() - self.t_start
+        moved = self.offset - self.bytes_start
+        rate = moved / secs if secs > 0 else 0
+        fc_rate = moved * 1000 / fc_ms if fc_ms > 0 else 0
+        self.report(f"Downloaded {final}: {moved} bytes in {secs:.1f} s, {rate / 1024:.2f} KB/s "
+                    f"(FC side {fc_rate / 1024:.2f} KB/s), {self.bad_lines} bad lines, {self.resumes} resumes", 100)
+        self.name = None
+
+
 class GroundControlStation(QMainWindow):
     def __init__(self):
         super().__init__()
         self.ser = None
         self.configs = {}
         self.serial_buffer = ""
+        self.downloader = LogDownloader(self.send_cmd_quiet, self.download_report)
         
         self.setWindowTitle("RACS - Ground Control Station")
         self.resize(1100, 700) 
@@ -97,6 +233,10 @@ class GroundControlStation(QMainWindow):
         self.btn_default.clicked.connect(lambda: self.send_cmd("DEFAULT"))
         eeprom_layout.addWidget(self.btn_default)
         
+        self.btn_stats = QPushButton("STATS (Logger)")
+        self.btn_stats.clicked.connect(lambda: self.send_cmd("STATS"))
+        eeprom_layout.addWidget(self.btn_stats)
+
         self.btn_reset = QPushButton("MAGICRESET (FC Reboot)")
         self.btn_reset.clicked.connect(lambda: self.send_cmd("MAGICRESET"))
         self.btn_reset.setStyleSheet("background-color: #118ab2; color: white; font-weight: bold;")
@@ -105,6 +245,33 @@ class GroundControlStation(QMainWindow):
         eeprom_box.setLayout(eeprom_layout)
         left_panel.addWidget(eeprom_box)
 
+        # --- Log Download Box ---
+        dl_box = QGroupBox("Flight Logs")
+        dl_layout = QVBoxLayout()
+
+        self.btn_ls = QPushButton("LIST Logs")
+        self.btn_ls.clicked.connect(self.list_logs)
+        dl_layout.addWidget(self.btn_ls)
+
+        self.log_combo = QComboBox()
+        dl_layout.addWidget(self.log_combo)
+
+        dl_btn_layout = QHBoxLayout()
+        self.btn_get = QPushButton("Download")
+        self.btn_get.clicked.connect(self.download_log)
+        dl_btn_layout.addWidget(self.btn_get)
+        self.btn_get_cancel = QPushButton("Cancel")
+        self.btn_get_cancel.clicked.connect(self.downloader.cancel)
+        dl_btn_layout.addWidget(self.btn_get_cancel)
+        dl_layout.addLayout(dl_btn_layout)
+
+        self.dl_progress = QProgressBar()
+        self.dl_progress.setValue(0)
+        dl_layout.addWidget(self.dl_progress)
+
+        dl_box.setLayout(dl_layout)
+        left_panel.addWidget(dl_box)
+
         # --- Manual Command Box ---
         cmd_box = QGroupBox("Command")
         cmd_layout = QHBoxLayout()
@@ -241,6 +408,28 @@ class GroundControlStation(QMainWindow):
             self.ser.write(full_cmd.encode('utf-8'))
             self.log_msg(f"Sent: {cmd}", "green")
 
+    def send_cmd_quiet(self, cmd):
+        # Download requests, too frequent for the message log
+        if self.ser and self.ser.is_open:
+            self.ser.write(f"{cmd}\n".encode('utf-8'))
+
+    def list_logs(self):
+        self.log_combo.clear()
+        self.send_cmd("LS")
+
+    def download_log(self):
+        name = self.log_combo.currentText().split(" ")[0]
+        if name and not self.downloader.active:
+            self.dl_progress.setValue(0)
+            self.log_msg(f"--- DOWNLOADING {name} ---", "purple")
+            self.downloader.start(name)
+
+    def download_report(self, text, percent=None):
+        if text:
+            self.log_msg(text, "purple")
+        if percent is not None:
+            self.dl_progress.setValue(percent)
+
     def send_manual_cmd(self):
         cmd = self.cmd_input.text().strip()
         if cmd:
@@ -329,7 +518,22 @@ class GroundControlStation(QMainWindow):
                 self.log_msg("--- BOOT COMPLETE: AUTO-DUMPING CONFIG ---", "purple")
                 self.send_cmd("DUMP")
 
-        # 4. Unformatted prints or debugs
+        # 4. Logger / runtime statistics
+        elif line.startswith("STAT:"):
+            self.log_msg(line, "#7b2cbf")
+
+        # 5. Log listing and download stream
+        elif self.downloader.feed(line):
+            pass
+
+        elif line.startswith("FILE:"):
+            parts = line.split(" ")
+            if len(parts) == 3 and parts[1] != "END":
+                self.log_combo.addItem(f"{parts[1]} ({int(parts[2]) // 1024} KB)")
+            else:
+                self.log_msg(line, "#7b2cbf")
+
+        # 6. Unformatted prints or debugs
         else:
             self.log_msg(line, "gray")
 
@@ -351,6 +555,8 @@ class GroundControlStation(QMainWindow):
                         # Process that complete line
                         self.process_line(line.strip())
 
+                self.downloader.poll()
+
             except Exception as e:
                 self.log_msg(f"Serial Error: {str(e)}", "red")
                 self.toggle_connection()
@@ -3,4 +3,5 @@
 #include "types.h"
 
 bool baro_init();
-void baro_read(FltData_t *fltdata);
\ No newline at end of file
+bool baro_read_start();             // Polls for a new sample, true if one is waiting for baro_read()
+bool baro_read(FltData_t *fltdata); // Reads the sample baro_read_start() found, true when fltdata got a new sample
\ No newline at end of file
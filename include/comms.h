@@ -2,5 +2,6 @@
 
 #include "types.h"
 
-void comms_read_cmd(FltStates_t *state);
+void comms_init();
+void comms_read_cmd(FltStates_t *state); // Also streams any log download in progress
 void comms_send_telem(FltStates_t state, FltData_t *fltdata);
\ No newline at end of file
@@ -8,7 +8,19 @@
 // Epoch 1 0xDEAD0001 FEB-19-2026
 // Epoch 2 0xDEAD0002 FEB-19-2026 Added switch to disable servo during burn
 // Epoch 3 0xDEAD0003 FEB-19-2026 Added motor burn time
-#define CFG_MAGIC 0xDEAD0003
+// Epoch 4 0xDEAD0004 OCT-17-2026 Added log preallocation and log close delay
+// Epoch 5 0xDEAD0005 OCT-17-2026 Replaced global log interval with per state log rates
+// Epoch 6 0xDEAD0006 OCT-17-2026 Added full rate raw IMU logging switch
+// Epoch 7 0xDEAD0007 OCT-17-2026 Added delta compressed log frames switch
+// Epoch 8 0xDEAD0008 OCT-17-2026 Added whole flight PSRAM capture
+// Epoch 9 0xDEAD0009 OCT-17-2026 Added IMU FIFO watermark acquisition
+// Epoch 10 0xDEAD000A OCT-17-2026 Added IMU interrupt clocked control loop
+// Epoch 11 0xDEAD000B OCT-17-2026 Added 20 bit IMU FIFO mode
+// Epoch 12 0xDEAD000C OCT-17-2026 Added IMU oversampling rate
+// Epoch 13 0xDEAD000D OCT-17-2026 Added stillness thresholds for the background gyro bias estimator
+// Epoch 14 0xDEAD000E OCT-17-2026 Added IMU temperature models
+// Epoch 15 0xDEAD000F OCT-17-2026 Added IMU calibration matrices
+#define CFG_MAGIC 0xDEAD000F
 
 typedef struct
 {
@@ -24,13 +36,38 @@ typedef struct
     float servo_limit_max_deg;
     float servo_us_per_deg;
 
+    float imu_still_accel_ms2; // max accel std dev per axis for the pad to count as still
+    float imu_still_gyro_dps;  // max gyro std dev per axis for the pad to count as still
+
+    // IMU temperature models per sensor axis, x y z before test mode flips, in
+    // dT = die temperature - 25C. Fitted by logtools/imutemp.py, zero disables.
+    //   corrected = (v - (b0 + b1 dT + b2 dT^2)) * (1 + k1 dT + k2 dT^2)
+    float imu_tc_accel[3][5]; // b0 b1 b2 in m/s^2, k1 k2
+    float imu_tc_gyro[3][5];  // b0 b1 b2 in rad/s, k1 k2
+
+    // IMU calibration after the temperature models, one row per body axis:
+    // weights of sensor x y z, then the offset. Covers scale, misalignment,
+    // bias and mounting. Fitted by logtools/imucal.py, identity by default.
+    float imu_cal_accel[3][4]; // offset in m/s^2
+    float imu_cal_gyro[3][4];  // offset in rad/s
+
     uint32_t motor_burn_time_ms;
     uint32_t parachute_charge_timeout_ms;
 
-    uint32_t log_interval_ms;
-    uint32_t log_flush_interval_ms;
+    uint32_t log_rate_ms[STATE_COUNT]; // log interval per flight state, 0 logs every control tick
+    uint32_t log_flush_interval_ms; // max time records sit in RAM before their block is sealed and written
+    uint32_t log_prealloc_mb;    // contiguous log extent reserved at boot, 0 appends instead
+    uint32_t log_close_delay_ms; // time in RECVY before the log file is finalized
+    uint32_t log_psram_flush_delay_ms; // time in RECVY before the PSRAM capture is written to the card
+    uint32_t imu_fifo_wm; // IMU FIFO frames per INT1 watermark interrupt, 0 polls the data registers instead
+    uint32_t imu_odr_hz;  // IMU sample rate, 1600, or 3200 and 6400 in FIFO mode
 
     bool en_servo_in_burn;
+    bool log_imu_raw_en; // log every IMU sample from ARM to RECVY
+    bool log_compress_en; // delta encode frames between keyframes
+    bool log_psram_en;    // capture ARM to RECVY in PSRAM, no card writes in flight
+    bool imu_fifo_hires_en; // 20 bit FIFO frames at 32g / 4000dps full scale, needs imu_fifo_wm
+    bool imu_irq_en;      // run the control loop off IMU INT1, data ready or FIFO watermark, instead of polling micros()
     bool test_mode_en;
 
 } EEPROMCfg_t;
@@ -2,8 +2,35 @@
 
 #include "types.h"
 
+#define PIN_IMU_INT1 2 // ICM45686 INT1, data ready or FIFO watermark interrupt
+
+// IMU bus. Build with -D IMU_SPI to move the ICM45686 off the I2C bus it shares
+// with the baro onto its own SPI1 port at the sensor's 24MHz maximum.
+// SPI1 pin map, the SPI0 SCK pin 13 is the LED:
+//   MOSI1 26, SCK1 27, MISO1 39 (alternate, pin 1 is Serial1 TX), CS1 38
+#ifdef IMU_SPI
+#define PIN_IMU_MISO 39
+#define PIN_IMU_CS 38
+#define IMU_BUS_HZ 24000000
+#else
+#define IMU_BUS_HZ 1000000 // I2C fast mode plus
+#endif
+#define IMU_FIFO_MAX 258 // frames one FIFO drain can return, the library burst buffer holds 258 16 byte frames
+
+typedef void (*ImuSampleCb_t)(const ImuSample_t *smp);
+
 bool imu_init();                                 // IMU initialization
-void imu_cal_gyro(FltData_t *fltdata);           // Calculates the gyro bias when stationary
-bool imu_read(FltData_t *fltdata);               // Reads raw accel and compensated gyro data from IMU
+uint16_t imu_read(FltData_t *fltdata);           // Reads all new samples, fltdata gets accel and compensated gyro of the newest, returns the sample count
+const ImuSample_t *imu_samples();                // Raw samples of the last imu_read(), oldest first
+uint32_t imu_period_us();                        // Sample period at the configured output data rate
+void imu_bias_update(FltData_t *fltdata);        // Refines gyro_bias from the last imu_read() samples whenever they are still, PREFLT only
+uint32_t imu_bias_windows();                     // Still windows averaged into gyro_bias so far, saturates
+void imu_cal_update();                           // Rebuilds the read path transforms, call after changing calibration or test mode
+void imu_bench_bus();                            // Prints the bus time of a sample read
+bool imu_ready();                                // INT1 flagged new data since the last imu_read(), needs config.imu_irq_en or the FIFO
+bool imu_irq_mode();                             // config.imu_irq_en as imu_init() found it, the loop ticks on imu_ready()
+bool imu_read_start();                           // Starts a background DMA sample read, false if one is running or not an IMU_SPI build
+void imu_set_read_cb(ImuSampleCb_t cb);          // Runs from the DMA interrupt each time a background read completes
+bool imu_latest(ImuSample_t *smp);               // Newest background sample, true if not returned before
 void imu_calc_initial_att(FltData_t *fltdata);   // Calculates initial attitude when stationary from pure accel data by finding grav vector
-void imu_calc_att(FltData_t *fltdata, float dt); // Calculates real time attitude in flight using pure gyro integration
+void imu_calc_att(FltData_t *fltdata, float dt); // Calculates real time attitude in flight using pure gyro integration, FIFO mode uses the coning compensated delta angle instead of dt
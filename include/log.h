@@ -3,8 +3,204 @@
 #include <stdio.h>
 #include "types.h"
 
+// MUST be incremented when any log record layout is changed
+// Version 1 OCT-17-2026 Binary frame records replace JSON lines
+// Version 2 OCT-17-2026 Added raw IMU sample records
+// Version 3 OCT-17-2026 Added stats footer record
+// Version 4 OCT-17-2026 Added delta compressed frame records
+// Version 5 OCT-17-2026 Records packed into CRC checked blocks, file header dropped
+// Version 6 OCT-17-2026 Added seek index footer
+// Version 7 OCT-17-2026 Added card latency histogram footer
+// Version 8 OCT-17-2026 Added baro, bias, event and config records, pressure, altitude and gyro_bias left frames
+// Version 9 OCT-17-2026 IMU records carry the low bits of 20 bit FIFO samples
+// Version 10 OCT-17-2026 IMU records carry the die temperature
+// Version 11 OCT-17-2026 Added dropped event count to the stats footer
+// Version 12 OCT-17-2026 Block header carries a per file id
+// Version 13 OCT-17-2026 Added PSRAM flush burst latency histogram record
+// Version 14 OCT-17-2026 Delta fields keep the sign of values that round to zero
+#define LOG_VERSION 14
+#define LOG_BLOCK_MAGIC 0x474F4C52 // "RLOG"
+
+#define LOG_BLOCK_SIZE 512 // SD sector, the writer only ever writes whole blocks
+#define LOG_RING_BLOCKS 128 // 64KB of RAM2, ~500ms of frames at the 1600Hz BURN/COAST rate
+
+// Pre-trigger window of raw IMU samples kept while waiting on the pad, sized for
+// 1600Hz, it covers a half or a quarter of the time when oversampling.
+// Build with -D LOG_PRETRIG_PSRAM to move it to PSRAM (chip must be fitted)
+#ifdef LOG_PRETRIG_PSRAM
+#define LOG_PRETRIG_SECONDS 10
+#else
+#define LOG_PRETRIG_SECONDS 2
+#endif
+#define LOG_PRETRIG_SAMPLES (LOG_PRETRIG_SECONDS * 1600)
+
+typedef enum
+{
+    LOG_REC_FRAME = 1, // LogFrame_t, one per log interval
+    LOG_REC_IMU = 2,   // ImuSample_t, raw sensor counts
+    LOG_REC_STATS = 3, // LogStats_t, written once by log_close()
+    LOG_REC_DELTA = 4, // Frame as varint deltas against the previous frame, see below
+    LOG_REC_INDEX = 5, // LogIndexEntry_t array, written by log_close()
+    LOG_REC_INDEX_END = 6, // LogIndexEnd_t, always the last record of a closed log
+    LOG_REC_LATENCY = 7,   // write and sync of LogLatency_t, written once by log_close()
+    LOG_REC_BARO = 8,      // LogBaro_t, one per new baro sample
+    LOG_REC_BIAS = 9,      // LogBias_t, whenever gyro_bias changes
+    LOG_REC_EVENT = 10,    // LogEvent_t followed by the event text, not terminated
+    LOG_REC_CONFIG = 11,   // "NAME VALUE" text of one tunable, the full set is written at ARM
+    LOG_REC_LATENCY_BURST = 12 // burst of LogLatency_t, after LOG_REC_LATENCY, all three don't fit one record
+} LogRecType_t;
+
+// The file is a sequence of LOG_BLOCK_SIZE blocks, each starting with this
+// header and followed by whole records. Records never straddle blocks, so any
+// block that passes its CRC decodes on its own after a crash or card damage.
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;   // LOG_BLOCK_MAGIC
+    uint32_t seq;     // block number since boot, gaps mean lost blocks
+    uint32_t file_id; // same in every block of a file, tells blocks of an older file left in the extent apart
+    uint16_t len;     // record bytes after the header, rest is zero padding
+    uint16_t version; // LOG_VERSION
+    uint32_t crc;     // CRC32 (zlib) of the first 16 header bytes and the record bytes
+} LogBlockHdr_t;
+
+#define LOG_BLOCK_PAYLOAD (LOG_BLOCK_SIZE - sizeof(LogBlockHdr_t))
+
+// Every record in a block starts with this header, payload follows directly
+typedef struct __attribute__((packed))
+{
+    uint8_t type; // LogRecType_t
+    uint8_t len;  // payload length in bytes, header excluded
+} LogRecHdr_t;
+
+// The per tick fields of the JSON schema produced by serializer(), little
+// endian. pressure, altitude and gyro_bias are only written when they change,
+// as LOG_REC_BARO and LOG_REC_BIAS, and readers carry the latest values over.
+typedef struct __attribute__((packed))
+{
+    uint32_t timestamp;
+    uint8_t state;
+    float accel[3];
+    float gyro[3];
+    float quat[4];
+    float servo_out[4];
+} LogFrame_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t ts_us;
+    float pressure;
+    float altitude;
+} LogBaro_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t ts_us;
+    float gyro_bias[3];
+} LogBias_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t ts_us;
+    uint8_t state; // state after the event
+} LogEvent_t;
+
+#define LOG_EVENT_TEXT_MAX 64
+
+// Delta frame payload, only written when config.log_compress_en is set:
+//   varint  timestamp delta in ms
+//   2 bytes little endian bitmask, bit n set if field n changed
+//   varint  zig-zag delta of each changed field, in field order
+// Fields are the 14 floats of LogFrame_t from accel to servo_out, quantized
+// to the JSON resolution (x1000, servo_out x10) exactly as printf rounds them,
+// minus one for negative values so -0.000 stays distinct from 0.000.
+// A frame with a field that is not finite or not below LOG_DELTA_LIMIT once
+// scaled is written as a keyframe and the next frame is a keyframe too.
+// A keyframe (LOG_REC_FRAME) resets the reference and is forced every
+// LOG_KEYFRAME_INTERVAL frames, on state change and after a dropped frame.
+#define LOG_FRAME_FIELDS 14
+#define LOG_KEYFRAME_INTERVAL 100
+#define LOG_DELTA_MAX (5 + 2 + LOG_FRAME_FIELDS * 5)
+#define LOG_DELTA_LIMIT 1e9 // scaled magnitude bound, keeps field deltas inside int32_t
+
+// Seek index, one entry on every state change and every LOG_INDEX_INTERVAL_MS.
+// When the table fills up every other periodic entry is dropped and the
+// interval doubles, so a long pad hold never costs the flight its entries.
+// Indexed frames are always keyframes, and a fresh copy of the baro and bias
+// records is queued from the indexed block onwards just before them, so
+// decoding can start at any entry.
+// The block with sequence number seq starts at file offset seq * LOG_BLOCK_SIZE.
+#define LOG_INDEX_MAX 2048
+#define LOG_INDEX_INTERVAL_MS 5000
+
+typedef struct __attribute__((packed))
+{
+    uint32_t seq;       // block holding the indexed frame
+    uint32_t timestamp; // frame timestamp, ms
+    uint8_t state;
+} LogIndexEntry_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t first_seq; // first block of the LOG_REC_INDEX records
+    uint32_t entries;
+} LogIndexEnd_t;
+
+// Logger health counters, also written as the log footer
+typedef struct __attribute__((packed))
+{
+    uint32_t overflows;       // records dropped because the ring was full
+    uint32_t stalls;          // log_service() calls skipped because the card was busy
+    uint32_t write_errors;    // sector writes the card rejected
+    uint32_t blocks_written;  // sectors written to the log file
+    uint16_t max_used_blocks; // ring high water mark
+    uint32_t imu_logged;      // full rate IMU records queued
+    uint32_t imu_dropped;     // full rate IMU records lost to ring overflow
+    uint32_t imu_gaps;        // sensor samples never read, from timestamp gaps
+    uint32_t events_dropped;  // log_event() entries lost because the journal was full
+} LogStats_t;
+
+// Duration histogram of one kind of card operation, timed with the DWT cycle
+// counter. Bucket n counts durations of [2^n, 2^(n+1)) us, bucket 0 also
+// takes 0us and the last bucket everything longer.
+#define LOG_LAT_BUCKETS 20 // last bucket starts at ~524ms
+
+typedef struct __attribute__((packed))
+{
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t bucket[LOG_LAT_BUCKETS];
+} LogLatHist_t;
+
+typedef struct __attribute__((packed))
+{
+    LogLatHist_t write; // one block, file write or raw sector write
+    LogLatHist_t sync;  // logfile.sync(), non raw mode only
+    LogLatHist_t burst; // one PSRAM capture flush write, up to 64 blocks
+} LogLatency_t;
+
 int serializer(char* buffer, size_t buf_size, uint32_t timestamp, FltStates_t state, const FltData_t* fltdata);
+void log_bench_serializer();                                                  // Prints serializer() timing against snprintf, checks output matches
+size_t log_encode_frame(uint8_t *buf, uint32_t timestamp, FltStates_t state, const FltData_t *fltdata);
 bool sd_init();
 bool log_init();
 bool logfile_init();
-bool log_write_frame(FltData_t *fltdata, FltStates_t fltstate, uint32_t ts);
+bool log_write_frame(FltData_t *fltdata, FltStates_t fltstate, uint32_t ts); // Queues a frame, never touches the card
+bool log_write_imu(const ImuSample_t *smp, FltStates_t fltstate);             // Queues a raw IMU record when full rate IMU logging is on
+bool log_write_baro(const FltData_t *fltdata);                                // Queues a baro record, call once per new sample
+void log_event(FltStates_t fltstate, const char *fmt, ...) __attribute__((format(printf, 2, 3))); // Prints "MSG: ..." and journals it with a micros() stamp, never blocks
+bool log_write_config(const char *text);                                      // Queues one "NAME VALUE" line of the config snapshot
+void log_service();                                                           // Writes at most one queued block to the card, call between control ticks
+void log_pretrig_push(const ImuSample_t *smp);                                 // Records one sample into the pre-trigger window
+void log_pretrig_dump();                                                      // Freezes the window and queues it for the log in the background
+bool log_capture_start();                                                     // From ARM, sealed blocks go to PSRAM instead of the card
+void log_capture_flush();                                                     // Writes the PSRAM capture to the card in the background
+bool log_close();                                                             // Flushes everything and finalizes the file, blocks on the card
+uint32_t log_crc32(const uint8_t *data, size_t len);                          // CRC32 (zlib), same as the block CRC
+bool log_ls_begin();                                                          // Starts listing the log files on the card
+bool log_ls_next(char *name, size_t len, uint32_t *size);                     // Next log file, false when done
+bool log_dl_open(const char *name, uint32_t *size);                           // Opens a closed log file for download, read only
+int log_dl_read(uint32_t offset, uint8_t *buf, size_t len);                   // Reads from the download file, -1 on error
+void log_dl_close();
+const LogStats_t *log_get_stats();
+const LogLatency_t *log_get_latency();
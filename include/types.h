@@ -12,17 +12,34 @@ typedef enum
     STATE_BURN,   // Motor burn, stability ctrl enabled
     STATE_COAST,  // Motor burnout, coasting with stability ctrl
     STATE_RECVY,  // Parachute out, stability ctrl off
-    STATE_OVRD    // Ground override for testing
+    STATE_OVRD,   // Ground override for testing
+    STATE_COUNT   // Number of states, not a state
 } FltStates_t;
 
+// One IMU sample exactly as read from the sensor, before scaling and bias
 typedef struct
 {
+    uint32_t ts_us;   // micros() at readout, or the sensor FIFO timestamp slewed onto the same scale
+    int16_t accel[3]; // x, y, z counts
+    int16_t gyro[3];  // x, y, z counts
+    uint8_t lsb[3];   // 20 bit FIFO mode: bits 3..0 of accel in the high nibble, gyro in the low one, 0 otherwise
+    int8_t temp;      // die temperature in 0.5C steps from 25C, the 8 bit FIFO format, finer readings rounded to nearest
+} ImuSample_t;
+
+typedef struct
+{
+
+    // Last raw IMU sample
+    ImuSample_t imu_raw;
 
     // Raw sensor data
     float accel[3]; // x, y, z
     float gyro[3];  // x, y, z
     float pressure;
 
+    // Coning compensated delta angle over the last imu_read(), FIFO mode only
+    float dtheta[3];
+
     // Computed altitude
     float altitude;
 
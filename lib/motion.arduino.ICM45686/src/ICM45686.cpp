@@ -49,7 +49,11 @@ static TwoWire *i2c = NULL;
 #define I2C_DEFAULT_CLOCK 400000
 #define I2C_MAX_CLOCK 1000000
 #define ICM456xx_I2C_ADDRESS 0x68
+#ifdef BUFFER_LENGTH
+#define ARDUINO_I2C_BUFFER_LENGTH BUFFER_LENGTH // Wire rx and tx buffer size
+#else
 #define ARDUINO_I2C_BUFFER_LENGTH 32
+#endif
 // spi
 static SPIClass *spi = NULL;
 static uint8_t chip_select_id = 0;
@@ -76,6 +80,10 @@ static int gaf_status = 0;
 // This is used by the getDataFromFifo callback (not object aware), declared static
 static inv_imu_device_t *icm_driver_ptr = NULL;
 
+// readFifo() burst buffer and the user handler frames are forwarded to while parsing
+static uint8_t fifo_burst[FIFO_MIRRORING_SIZE];
+static ICM456xx_sensor_event_cb fifo_event_handler = NULL;
+
 // ICM456xx constructor for I2c interface
 ICM456xx::ICM456xx(TwoWire &i2c_ref,bool lsb, uint32_t freq) {
   i2c = &i2c_ref; 
@@ -181,6 +189,44 @@ int ICM456xx::getDataFromRegisters(inv_imu_sensor_data_t& data) {
     return inv_imu_get_register_data(&icm_driver, &data);
 }
 
+#if defined(__IMXRT1062__)
+// Same read as getDataFromRegisters() on the SPI interface, but clocked out by
+// the SPI DMA so the caller keeps running. done fires from the DMA interrupt,
+// finishDataFromRegisters() must follow before any other access to the device.
+static uint8_t async_tx[1 + sizeof(inv_imu_sensor_data_t)];
+static uint8_t async_rx[1 + sizeof(inv_imu_sensor_data_t)];
+
+int ICM456xx::startDataFromRegisters(EventResponder& done) {
+  if(spi == NULL) {
+    return -1;
+  }
+
+  memset(async_tx, 0, sizeof(async_tx));
+  async_tx[0] = ACCEL_DATA_X1_UI | SPI_READ;
+  spi->beginTransaction(SPISettings(clk_freq, MSBFIRST, SPI_MODE3));
+  digitalWrite(chip_select_id,LOW);
+  if(!spi->transfer(async_tx, async_rx, sizeof(async_tx), done)) {
+    digitalWrite(chip_select_id,HIGH);
+    spi->endTransaction();
+    return -1;
+  }
+  return 0;
+}
+
+int ICM456xx::finishDataFromRegisters(inv_imu_sensor_data_t& data) {
+  int16_t *reg16 = (int16_t *)&data;
+
+  digitalWrite(chip_select_id,HIGH);
+  spi->endTransaction();
+
+  memcpy(&data, &async_rx[1], sizeof(data));
+  for(uint8_t i = 0; i < sizeof(data) / sizeof(int16_t); i++) {
+    FORMAT_16_BITS_DATA(icm_driver.endianness_data, (uint8_t *)&reg16[i], (uint16_t *)&reg16[i]);
+  }
+  return 0;
+}
+#endif
+
 int ICM456xx::setup_irq(uint8_t intpin, ICM456xx_irq_handler handler)
 {
   int rc = 0;
@@ -196,36 +242,121 @@ int ICM456xx::setup_irq(uint8_t intpin, ICM456xx_irq_handler handler)
   pinMode(intpin,INPUT);
   rc |= inv_imu_set_pin_config_int(&icm_driver, INV_IMU_INT1, &it_pins);
   rc |= inv_imu_set_config_int(&icm_driver, INV_IMU_INT1, &it_conf);
-  attachInterrupt(intpin,handler,HIGH);
+  // INT1 is configured as an active high pulse, a level trigger would re-enter
+  // the handler for as long as the pulse lasts
+  attachInterrupt(intpin,handler,RISING);
   return rc;
 }
 
-int ICM456xx::enableFifoInterrupt(uint8_t intpin, ICM456xx_irq_handler handler, uint8_t fifo_watermark) {
+// Accel and gyro frames with the 1us timestamp. hires selects the 20 byte
+// frames with 20 bit accel and gyro data, see readFifo() for the layout.
+// Configured through the advanced driver so its FIFO parser state matches.
+int ICM456xx::enableFifoInterrupt(uint8_t intpin, ICM456xx_irq_handler handler, uint8_t fifo_watermark, bool hires) {
   int rc = 0;
-  inv_imu_int_state_t it_conf;
-  const inv_imu_fifo_config_t fifo_config = {
-    .gyro_en=true,
-    .accel_en=true,
-    . hires_en=false,
-    .fifo_wm_th=fifo_watermark,
-    .fifo_mode=FIFO_CONFIG0_FIFO_MODE_SNAPSHOT,
-    .fifo_depth=FIFO_CONFIG0_FIFO_DEPTH_MAX
+  const inv_imu_adv_fifo_config_t fifo_config = {
+    .base_conf = {
+      .gyro_en    = INV_IMU_ENABLE,
+      .accel_en   = INV_IMU_ENABLE,
+      .hires_en   = (uint8_t)(hires ? INV_IMU_ENABLE : INV_IMU_DISABLE),
+      .fifo_wm_th = fifo_watermark,
+      .fifo_mode  = FIFO_CONFIG0_FIFO_MODE_SNAPSHOT,
+      .fifo_depth = FIFO_CONFIG0_FIFO_DEPTH_MAX
+    },
+    .fifo_wr_wm_gt_th     = FIFO_CONFIG2_FIFO_WR_WM_EQ_OR_GT_TH,
+    .tmst_fsync_en        = INV_IMU_ENABLE,
+    .es1_en               = INV_IMU_DISABLE,
+    .es0_en               = INV_IMU_DISABLE,
+    .es0_6b_9b            = FIFO_CONFIG4_FIFO_ES0_6B,
+    .comp_en              = INV_IMU_DISABLE,
+    .comp_nc_flow_cfg     = FIFO_CONFIG4_FIFO_COMP_NC_FLOW_CFG_DIS,
+    .gyro_dec             = ODR_DECIMATE_CONFIG_GYRO_FIFO_ODR_DEC_1,
+    .accel_dec            = ODR_DECIMATE_CONFIG_ACCEL_FIFO_ODR_DEC_1
   };
   if(handler == NULL) {
     return -1;
   }
 
-  rc |= inv_imu_set_fifo_config(&icm_driver, &fifo_config);
+  rc |= inv_imu_adv_set_fifo_config(&icm_driver, &fifo_config);
 
   rc |= setup_irq(intpin, handler);
+
+  // Latch FIFO full in INT1_STATUS0 too, readFifo() reports it as an overflow
+  inv_imu_int_state_t it_conf;
+  rc |= inv_imu_get_config_int(&icm_driver, INV_IMU_INT1, &it_conf);
+  it_conf.INV_FIFO_FULL = INV_IMU_ENABLE;
+  rc |= inv_imu_set_config_int(&icm_driver, INV_IMU_INT1, &it_conf);
   return rc;
 }
 
+// Pulses INT1 each time a new sample lands in the data registers
+int ICM456xx::enableDataReadyInterrupt(uint8_t intpin, ICM456xx_irq_handler handler) {
+  int rc = 0;
+  inv_imu_int_state_t it_conf;
+  const inv_imu_int_pin_config_t it_pins = {
+    .int_polarity=INTX_CONFIG2_INTX_POLARITY_HIGH,
+    .int_mode=INTX_CONFIG2_INTX_MODE_PULSE,
+    .int_drive=INTX_CONFIG2_INTX_DRIVE_PP
+  };
+  if(handler == NULL) {
+    return -1;
+  }
+
+  memset(&it_conf, INV_IMU_DISABLE, sizeof(it_conf));
+  it_conf.INV_UI_DRDY = INV_IMU_ENABLE;
+  pinMode(intpin,INPUT);
+  rc |= inv_imu_set_pin_config_int(&icm_driver, INV_IMU_INT1, &it_pins);
+  rc |= inv_imu_set_config_int(&icm_driver, INV_IMU_INT1, &it_conf);
+  attachInterrupt(intpin,handler,RISING);
+  return rc;
+}
 
 int ICM456xx::getDataFromFifo(inv_imu_fifo_data_t& data) {
   return inv_imu_get_fifo_frame(&icm_driver,&data);
 }
 
+// Reads every frame pending in the FIFO with a single FIFO_DATA burst instead of
+// one transfer per frame, then calls handler once per frame, oldest first.
+// frame_count is the number of frames read, capped to the burst buffer size,
+// and overflow is set if the FIFO was full, so later frames were dropped.
+// In hires mode the event accel and gyro hold bits 19..4 and accel_high_res
+// and gyro_high_res bits 3..0 of the 20 bit value.
+int ICM456xx::readFifo(ICM456xx_sensor_event_cb handler, uint16_t& frame_count, bool& overflow) {
+  int rc = 0;
+  uint16_t max_frames;
+  inv_imu_int_state_t it_status;
+
+  frame_count = 0;
+  overflow = false;
+  if((handler == NULL) || (icm_driver.fifo_frame_size == 0)) {
+    return -1;
+  }
+
+  // Read to clear. The FIFO filled up since the last drain, in snapshot mode
+  // frames after the ones queued now were dropped.
+  rc |= inv_imu_get_int_status(&icm_driver, INV_IMU_INT1, &it_status);
+  overflow = (rc == 0) && it_status.INV_FIFO_FULL;
+
+  rc |= inv_imu_get_frame_count(&icm_driver, &frame_count);
+  max_frames = sizeof(fifo_burst) / icm_driver.fifo_frame_size;
+  if(frame_count > max_frames) {
+    frame_count = max_frames;
+  }
+  if((rc != 0) || (frame_count == 0)) {
+    return rc;
+  }
+
+  rc |= inv_imu_read_reg(&icm_driver, FIFO_DATA, frame_count * icm_driver.fifo_frame_size, fifo_burst);
+  if(rc != 0) {
+    frame_count = 0;
+    return rc;
+  }
+
+  fifo_event_handler = handler;
+  rc |= inv_imu_adv_parse_fifo_data(&icm_driver, fifo_burst, frame_count);
+  fifo_event_handler = NULL;
+  return rc;
+}
+
 #if defined(ICM45686S) || defined(ICM45605S) || defined(ICM45608) || defined(ICM45689)
 int ICM456xx::startGaf(uint8_t intpin, ICM456xx_irq_handler handler, uint8_t algo)
 {
@@ -515,6 +646,12 @@ int32_t gyro_data[3];
 /* FIFO sensor event callback */
 static void sensor_event_cb(inv_imu_sensor_event_t *event)
 {
+  if(fifo_event_handler != NULL)
+  {
+    fifo_event_handler(event);
+    return;
+  }
+
   if(event->sensor_mask & (1 << INV_SENSOR_ACCEL))
   {
     accel_data[0] = event->accel[0];
@@ -1008,54 +1145,68 @@ int ICM456xx::updateApex(void)
 }
 
 
+// Register writes go out as one transaction. Anything longer than the Wire
+// buffer would be silently truncated, so it is refused instead. Longer
+// payloads only ever target the indirect registers, which are written a
+// byte at a time by the transport layer anyway.
 static int i2c_write(uint8_t reg, const uint8_t * wbuffer, uint32_t wlen) {
+  if((wlen + 1) > ARDUINO_I2C_BUFFER_LENGTH) {
+    return INV_IMU_ERROR_BAD_ARG;
+  }
+
   i2c->beginTransmission(i2c_address);
   i2c->write(reg);
-  for(uint8_t i = 0; i < wlen; i++) {
-    i2c->write(wbuffer[i]);
+  i2c->write(wbuffer, wlen);
+  if(i2c->endTransmission() != 0) {
+    return INV_IMU_ERROR_TRANSPORT;
   }
-  i2c->endTransmission();
   return 0;
 }
 
+// Register reads are a single bus transaction: the register address, then
+// the data in Wire buffer sized pieces chained with repeated starts, so the
+// device keeps auto incrementing (or popping FIFO_DATA) and only the last
+// piece ends with a STOP. Any length up to a full FIFO drain goes in one go.
 static int i2c_read(uint8_t reg, uint8_t * rbuffer, uint32_t rlen) {
-  uint16_t offset = 0;
+  uint32_t offset = 0;
+
+  if(rlen == 0) {
+    return 0;
+  }
 
   i2c->beginTransmission(i2c_address);
   i2c->write(reg);
-  i2c->endTransmission(false);
+  if(i2c->endTransmission(false) != 0) {
+    return INV_IMU_ERROR_TRANSPORT;
+  }
+
   while(offset < rlen)
   {
-    uint16_t rx_bytes = 0;
-    if(offset != 0)
-      i2c->beginTransmission(i2c_address);
-    uint16_t length = ((rlen - offset) > ARDUINO_I2C_BUFFER_LENGTH) ? ARDUINO_I2C_BUFFER_LENGTH : (rlen - offset) ;
-    rx_bytes = i2c->requestFrom(i2c_address, length);
-    if (rx_bytes == length) {
-      for(uint8_t i = 0; i < length; i++) {
-        rbuffer[offset+i] = i2c->read();
-      }
-      offset += length;
-      i2c->endTransmission((offset == rlen));
-    } else {
-      i2c->endTransmission((offset == rlen));
+    uint32_t length = ((rlen - offset) > ARDUINO_I2C_BUFFER_LENGTH) ? ARDUINO_I2C_BUFFER_LENGTH : (rlen - offset);
+    bool last = (offset + length) == rlen;
+
+    if(i2c->requestFrom(i2c_address, (uint8_t)length, (uint8_t)last) != length) {
+      return INV_IMU_ERROR_TRANSPORT;
     }
+    for(uint32_t i = 0; i < length; i++) {
+      rbuffer[offset + i] = i2c->read();
+    }
+    offset += length;
   }
-  if(offset == rlen)
-  {
-    return 0;
-  } else {
-    return -1;
-  }
+  return 0;
 }
 
 static int spi_write(uint8_t reg, const uint8_t * wbuffer, uint32_t wlen) {
   spi->beginTransaction(SPISettings(clk_freq, MSBFIRST, SPI_MODE3));
   digitalWrite(chip_select_id,LOW);
   spi->transfer(reg);
-  for(uint8_t i = 0; i < wlen; i++) {
+#if defined(__IMXRT1062__)
+  spi->transfer(wbuffer, NULL, wlen);
+#else
+  for(uint32_t i = 0; i < wlen; i++) {
     spi->transfer(wbuffer[i]);
   }
+#endif
   digitalWrite(chip_select_id,HIGH);
   spi->endTransaction();
   return 0;
@@ -52,7 +52,7 @@ enum {
 };
 
 // This defines the handler called when retrieving a sample from the FIFO
-//typedef void (*ICM456xx_sensor_event_cb)(inv_imu_sensor_data_t *event);
+typedef void (*ICM456xx_sensor_event_cb)(inv_imu_sensor_event_t *event);
 // This defines the handler called when receiving an irq
 typedef void (*ICM456xx_irq_handler)(void);
 
@@ -66,8 +66,14 @@ class ICM456xx {
     int startAccel(uint16_t odr, uint16_t fsr);
     int startGyro(uint16_t odr, uint16_t fsr);
     int getDataFromRegisters(inv_imu_sensor_data_t& data);
-    int enableFifoInterrupt(uint8_t intpin, ICM456xx_irq_handler handler, uint8_t fifo_watermark);
+#if defined(__IMXRT1062__)
+    int startDataFromRegisters(EventResponder& done);
+    int finishDataFromRegisters(inv_imu_sensor_data_t& data);
+#endif
+    int enableFifoInterrupt(uint8_t intpin, ICM456xx_irq_handler handler, uint8_t fifo_watermark, bool hires=false);
+    int enableDataReadyInterrupt(uint8_t intpin, ICM456xx_irq_handler handler);
     int getDataFromFifo(inv_imu_fifo_data_t& data);
+    int readFifo(ICM456xx_sensor_event_cb handler, uint16_t& frame_count, bool& overflow);
 #if defined(ICM45686S) || defined(ICM45605S) || defined(ICM45608) || defined(ICM45689)
     int startGaf(uint8_t intpin, ICM456xx_irq_handler handler, uint8_t algo);
     int getGafData(inv_imu_edmp_gaf_outputs_t& gaf_outputs);
@@ -0,0 +1,201 @@
+import re
+import sys
+import mmap
+import argparse
+import numpy as np
+import logdecode as ld
+import imutemp
+
+# Fits the IMU calibration matrices of EEPROMCfg_t (imu_cal_accel, imu_cal_gyro)
+# from a six position tumble log and prints them as SET commands.
+#
+# The tumble is logged in OVRD with LOG_IMU_RAW_EN set: the rocket (or its
+# fixture) rests for a few seconds on each of its six faces, x y z up and
+# down, and is turned by hand between rests. Every rest must be on a face
+# whose normal is a body axis, the turns can take any path.
+#
+# Accel: each rest must read 1g along the body axis pointing up, so
+#   cal * reading + offset = +-1g on that axis
+# is linear in the 12 unknowns and solved by least squares. That takes out
+# scale, cross axis misalignment, bias and the mounting rotation together.
+#
+# Gyro: the offset is the mean reading at rest. The matrix is fitted by
+# Gauss-Newton so that integrating each turn carries the calibrated gravity
+# direction of one rest onto that of the next. Turns about all three body
+# axes are needed for the matrix to be fully determined.
+#
+# The temperature models (IMU_TC_*) are applied first, exactly like the
+# firmware does, using --config if given.
+
+STILL_WINDOW_S = 0.2
+STILL_MIN_S = 1.0
+CHUNK = 4  # samples summed per integration step, coning is negligible at hand speeds
+
+
+def parse_mount(text):
+    """'+x+y+z' style signed permutation, body axis i = sign * sensor axis. 3x3 matrix."""
+    parts = re.findall(r"([+-])([xyz])", text.lower())
+    if len(parts) != 3 or len({a for _, a in parts}) != 3:
+        sys.exit(f"bad --mount {text}, expected e.g. +x-z+y")
+    p = np.zeros((3, 3))
+    for i, (sign, axis) in enumerate(parts):
+        p[i, "xyz".index(axis)] = 1.0 if sign == "+" else -1.0
+    return p
+
+
+def load_tc(path):
+    """IMU_TC_* from DUMP output or a --config snapshot, zero when absent."""
+    tc = np.zeros((6, 5))
+    if path:
+        for line in open(path):
+            m = re.search(r"IMU_TC_([AG][XYZ])_([BK][012])\s+(\S+)", line.strip())
+            if m:
+                tc[imutemp.AXES.index(m[1]), imutemp.COEFS.index(m[2])] = float(m[3])
+    return tc
+
+
+def load_tumble(path, hires, tc):
+    """ts in s, accel and gyro in sensor axis m/s^2 and rad/s with the temperature models applied."""
+    with open(path, "rb") as f:
+        raw = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    smps = {rec[0]: rec for rec in ld.imu_samples(raw)}  # unwrapped, a tumble may cross the micros() wrap
+    if not smps:
+        sys.exit(f"{path}: no IMU records, tumble with LOG_IMU_RAW_EN in OVRD")
+
+    data = np.array(sorted(smps.values()), dtype=float)
+    scale = np.array([imutemp.ACCEL_SCALE[hires]] * 3 + [imutemp.GYRO_SCALE[hires]] * 3)
+    v = data[:, 1:7] * scale
+    dt = (data[:, 7] - 25)[:, None]
+    bias = tc[:, 0] + (tc[:, 1] + tc[:, 2] * dt) * dt
+    gain = 1 + (tc[:, 3] + tc[:, 4] * dt) * dt
+    v = (v - bias) * gain
+    return data[:, 0] * 1e-6, v[:, :3], v[:, 3:]
+
+
+def find_rests(ts, accel, gyro, accel_std, gyro_dps):
+    """(start, end) sample ranges where the board sat still for at least STILL_MIN_S."""
+    period = np.median(np.diff(ts))
+    win = max(int(STILL_WINDOW_S / period), 2)
+    rest_rate = np.median(gyro, axis=0)  # mostly resting, so close to the gyro bias
+
+    still = []
+    for s in range(0, len(ts) - win + 1, win):
+        a, g = accel[s:s + win], gyro[s:s + win]
+        still.append(np.all(a.std(axis=0) < accel_std) and
+                     np.all(np.abs(g - rest_rate) < gyro_dps * imutemp.DEG_2_RAD))
+
+    rests, start = [], None
+    for i, ok in enumerate(still + [False]):
+        if ok and start is None:
+            start = i
+        elif not ok and start is not None:
+            # Drop the edge windows, they may hold the start or end of a turn
+            if (i - start - 2) * win * period >= STILL_MIN_S:
+                rests.append(((start + 1) * win, (i - 1) * win))
+            start = None
+    return rests
+
+
+def fit_accel(means, mount):
+    """Least squares cal, offset with cal @ mean + offset = 1g on the body axis facing up."""
+    targets = np.zeros_like(means)
+    for k, m in enumerate(means):
+        d = mount @ m
+        axis = int(np.argmax(np.abs(d)))
+        targets[k, axis] = np.sign(d[axis]) * imutemp.G_MS2
+
+    faces = {(int(np.argmax(np.abs(t))), np.sign(t[np.argmax(np.abs(t))])) for t in targets}
+    if len(faces) < 6:
+        sys.exit(f"only {len(faces)} of the six faces found at rest, tumble through all of them")
+
+    a = np.hstack([means, np.ones((len(means), 1))])
+    x, *_ = np.linalg.lstsq(a, targets, rcond=None)
+    return x[:3].T, x[3], targets
+
+
+def quat_mul(p, q):
+    return np.array([p[0] * q[0] - p[1] * q[1] - p[2] * q[2] - p[3] * q[3],
+                     p[0] * q[1] + p[1] * q[0] + p[2] * q[3] - p[3] * q[2],
+                     p[0] * q[2] - p[1] * q[3] + p[2] * q[0] + p[3] * q[1],
+                     p[0] * q[3] + p[1] * q[2] - p[2] * q[1] + p[3] * q[0]])
+
+
+def rotate_back(phis, u):
+    """u, fixed in the frame of the first step, seen from the body after all the rotation vectors phis."""
+    q = np.array([1.0, 0.0, 0.0, 0.0])
+    for phi in phis:
+        angle = np.linalg.norm(phi)
+        s = np.sin(angle / 2) / angle if angle > 1e-9 else 0.5
+        q = quat_mul(q, np.array([np.cos(angle / 2), *(phi * s)]))
+    w, x, y, z = q / np.linalg.norm(q)
+    r = np.array([[1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y)],
+                  [2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x)],
+                  [2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y)]])
+    return r.T @ u
+
+
+def fit_gyro(turns, g0, iterations=20):
+    """Gauss-Newton for the 3x3 gyro cal. turns are (chunked sensor delta angles, u_before, u_after)."""
+
+    def residuals(g):
+        return np.concatenate([rotate_back(chunks @ g.T, u0) - u1 for chunks, u0, u1 in turns])
+
+    g = g0.copy()
+    for _ in range(iterations):
+        r = residuals(g)
+        jac = np.empty((len(r), 9))
+        for p in range(9):
+            step = np.zeros(9)
+            step[p] = 1e-6
+            jac[:, p] = (residuals(g + step.reshape(3, 3)) - r) / 1e-6
+        dx, *_ = np.linalg.lstsq(jac, -r, rcond=None)
+        g += dx.reshape(3, 3)
+        if np.max(np.abs(dx)) < 1e-7:
+            break
+    return g, residuals(g)
+
+
+if __name__ == "__main__":
+    ap = argparse.ArgumentParser(description="Fit the IMU calibration matrices from a six position tumble log")
+    ap.add_argument("log")
+    ap.add_argument("--hires", action="store_true", help="log was recorded with IMU_FIFO_HIRES_EN")
+    ap.add_argument("--mount", default="+x+y+z", help="nominal sensor axis on each body axis, e.g. +y-x+z")
+    ap.add_argument("--config", help="DUMP output with the IMU_TC_* temperature models to apply first")
+    ap.add_argument("--still-accel", type=float, default=0.1, help="max accel std dev at rest, m/s^2")
+    ap.add_argument("--still-gyro", type=float, default=1.0, help="max gyro deviation at rest, dps")
+    args = ap.parse_args()
+
+    mount = parse_mount(args.mount)
+    ts, accel, gyro = load_tumble(args.log, args.hires, load_tc(args.config))
+    rests = find_rests(ts, accel, gyro, args.still_accel, args.still_gyro)
+    print(f"# {len(ts)} samples, {len(rests)} rests")
+
+    acc_means = np.array([accel[s:e].mean(axis=0) for s, e in rests])
+    acc_cal, acc_ofs, targets = fit_accel(acc_means, mount)
+    err = np.linalg.norm(acc_means @ acc_cal.T + acc_ofs - targets, axis=1)
+    print(f"# accel: rest error max {err.max():.4f} m/s^2, rms {np.sqrt(np.mean(err ** 2)):.4f}")
+
+    rest_idx = np.concatenate([np.arange(s, e) for s, e in rests])
+    gyro_rest = gyro[rest_idx].mean(axis=0)
+
+    turns = []
+    dts = np.diff(ts, append=ts[-1])
+    for (s0, e0), (s1, e1) in zip(rests, rests[1:]):
+        u0 = acc_cal @ accel[s0:e0].mean(axis=0) + acc_ofs
+        u1 = acc_cal @ accel[s1:e1].mean(axis=0) + acc_ofs
+        d = (gyro[e0:s1] - gyro_rest) * dts[e0:s1, None]
+        n = len(d) // CHUNK * CHUNK
+        chunks = np.vstack([d[:n].reshape(-1, CHUNK, 3).sum(axis=1), d[n:].sum(axis=0, keepdims=True)])
+        turns.append((chunks, u0 / np.linalg.norm(u0), u1 / np.linalg.norm(u1)))
+
+    gyro_cal, res = fit_gyro(turns, mount)
+    ang = np.degrees(np.arcsin(np.clip(np.linalg.norm(res.reshape(-1, 3), axis=1), 0, 1)))
+    print(f"# gyro: {len(turns)} turns, end attitude error max {ang.max():.2f} deg")
+    gyro_ofs = -gyro_cal @ gyro_rest
+
+    for name, cal, ofs in (("A", acc_cal, acc_ofs), ("G", gyro_cal, gyro_ofs)):
+        for i, axis in enumerate("XYZ"):
+            for j, col in enumerate("XYZ"):
+                print(f"SET IMU_CAL_{name}{axis}_{col} {cal[i, j]:.6g}")
+            print(f"SET IMU_CAL_{name}{axis}_OFS {ofs[i]:.6g}")
@@ -0,0 +1,115 @@
+import sys
+import mmap
+import argparse
+import numpy as np
+import logdecode as ld
+
+# Fits the IMU temperature models of EEPROMCfg_t (imu_tc_accel, imu_tc_gyro)
+# from thermal soak logs and prints them as SET commands.
+#
+# A soak log is the board sitting still in OVRD with LOG_IMU_RAW_EN set while
+# it warms or cools through the temperature range it will see on the pad and
+# in flight. Every log is averaged per 0.5C temperature step, then per axis
+#   measured = true * (1 + s0 + s1 dT + s2 dT^2) + b0 + b1 dT + b2 dT^2
+# is fitted by least squares, dT = temp - 25C. The true value is 1g on the
+# axis that points up or down and zero everywhere else. The scale terms only
+# separate from the bias on axes that saw two different true values, so
+# accel scale needs soaks in at least two orientations, and gyro scale a
+# rate table (--gyro-rate). s0 is left to the static calibration, the
+# firmware gain 1 + k1 dT + k2 dT^2 undoes s1 and s2 only.
+
+G_MS2 = 9.80665
+DEG_2_RAD = np.pi / 180
+ACCEL_SCALE = {False: 16 / 32768 * G_MS2, True: 32 / 32768 * G_MS2}  # per count, 16 or 20 bit FIFO
+GYRO_SCALE = {False: 2000 / 32768 * DEG_2_RAD, True: 4000 / 32768 * DEG_2_RAD}
+
+AXES = ("AX", "AY", "AZ", "GX", "GY", "GZ")
+COEFS = ("B0", "B1", "B2", "K1", "K2")
+
+
+def load_soak(path, hires):
+    """Per 0.5C step: (temp_c, sample count, mean of the six axes in m/s^2 and rad/s)."""
+    with open(path, "rb") as f:
+        raw = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    smps = {rec[0]: rec for rec in ld.imu_samples(raw)}  # the pre-trigger window repeats samples
+    if not smps:
+        sys.exit(f"{path}: no IMU records, soak with LOG_IMU_RAW_EN in OVRD")
+
+    data = np.array(list(smps.values()), dtype=float)
+    scale = np.array([ACCEL_SCALE[hires]] * 3 + [GYRO_SCALE[hires]] * 3)
+    steps = []
+    for t in np.unique(data[:, 7]):
+        sel = data[data[:, 7] == t]
+        steps.append((t, len(sel), sel[:, 1:7].mean(axis=0) * scale))
+    return steps
+
+
+def true_values(steps, gyro_rate):
+    """Reference reading of each axis over a whole log."""
+    mean = np.average([m for _, _, m in steps], axis=0, weights=[n for _, n, _ in steps])
+    true = np.zeros(6)
+    up = int(np.argmax(np.abs(mean[:3])))
+    if abs(mean[up]) > 0.5 * G_MS2:
+        true[up] = np.sign(mean[up]) * G_MS2
+    for axis, dps in gyro_rate:
+        true[3 + axis] = dps * DEG_2_RAD
+    return true
+
+
+def fit_axis(rows):
+    """rows of (dT, n, true, measured) for one axis. Returns b0 b1 b2 k1 k2, rms and scale flag."""
+    dt, n, true, meas = (np.array(c, dtype=float) for c in zip(*rows))
+    cols = [np.ones_like(dt), dt, dt ** 2]
+    scaled = len(np.unique(np.round(true, 6))) > 1
+    if scaled:
+        cols += [true, true * dt, true * dt ** 2]
+    a = np.stack(cols, axis=1)
+    w = np.sqrt(n)[:, None]
+
+    x, *_ = np.linalg.lstsq(a * w, (meas - true) * w[:, 0], rcond=None)
+    rms = np.sqrt(np.average((a @ x - (meas - true)) ** 2, weights=n))
+
+    b0, b1, b2 = x[:3]
+    k1 = k2 = 0.0
+    if scaled:
+        # Second order inverse of 1 + s1' dT + s2' dT^2, s' relative to 1 + s0
+        s1, s2 = x[4] / (1 + x[3]), x[5] / (1 + x[3])
+        k1, k2 = -s1, s1 * s1 - s2
+    return (b0, b1, b2, k1, k2), rms, scaled
+
+
+if __name__ == "__main__":
+    ap = argparse.ArgumentParser(description="Fit IMU temperature models from thermal soak logs")
+    ap.add_argument("logs", nargs="+", help="soak logs, board still, one orientation per log")
+    ap.add_argument("--hires", action="store_true", help="logs were flown with IMU_FIFO_HIRES_EN")
+    ap.add_argument("--gyro-rate", action="append", default=[], metavar="LOG:AXIS:DPS",
+                    help="known rate of a rate table log, e.g. 2:z:90 for the third log")
+    args = ap.parse_args()
+
+    rates = {}
+    for spec in args.gyro_rate:
+        idx, axis, dps = spec.split(":")
+        rates.setdefault(int(idx), []).append(("xyz".index(axis.lower()), float(dps)))
+
+    rows = [[] for _ in AXES]
+    t_lo, t_hi = 1e9, -1e9
+    for i, path in enumerate(args.logs):
+        steps = load_soak(path, args.hires)
+        true = true_values(steps, rates.get(i, []))
+        for t, n, m in steps:
+            t_lo, t_hi = min(t_lo, t), max(t_hi, t)
+            for a in range(6):
+                rows[a].append((t - 25, n, true[a], m[a]))
+        print(f"# {path}: {sum(n for _, n, _ in steps)} samples, {steps[0][0]:.1f}C to {steps[-1][0]:.1f}C")
+
+    if t_hi - t_lo < 10:
+        print(f"# only {t_hi - t_lo:.1f}C of temperature span, the dT^2 terms are poorly determined")
+
+    for a, name in enumerate(AXES):
+        coefs, rms, scaled = fit_axis(rows[a])
+        unit = "m/s^2" if a < 3 else "rad/s"
+        note = "" if scaled else ", scale not observable, K1 K2 left at 0"
+        print(f"# {name}: residual rms {rms:.3g} {unit}{note}")
+        for c, v in zip(COEFS, coefs):
+            print(f"SET IMU_TC_{name}_{c} {v:.6g}")
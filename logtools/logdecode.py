@@ -0,0 +1,465 @@
+import sys
+import math
+import mmap
+import argparse
+import struct
+import zlib
+
+# --- LOG FORMAT (must match include/log.h) ---
+LOG_VERSION = 14
+
+BLOCK_SIZE = 512
+BLOCK_MAGIC = 0x474F4C52  # "RLOG"
+BLOCK_HDR = struct.Struct("<IIIHHI")
+BLOCK_PAYLOAD = BLOCK_SIZE - BLOCK_HDR.size
+
+REC_HDR = struct.Struct("<BB")
+
+LOG_REC_FRAME = 1
+FRAME = struct.Struct("<IB14f")
+
+LOG_REC_IMU = 2
+IMU = struct.Struct("<I3h3h3Bb")  # ts_us, accel, gyro, 20 bit low nibbles, temp in 0.5C from 25C
+
+LOG_REC_STATS = 3
+STATS = struct.Struct("<IIIIHIIII")
+STATS_FIELDS = ("overflows", "stalls", "write_errors", "blocks_written", "max_used_blocks",
+                "imu_logged", "imu_dropped", "imu_gaps", "events_dropped")
+
+LOG_REC_DELTA = 4
+DELTA_SCALE = [1000] * 10 + [10] * 4  # JSON resolution of the 14 frame floats
+DELTA_LIMIT = 1e9  # keyframes with a scaled field beyond this, or not finite, are never followed by deltas
+FIELD_DECIMALS = [3] * 10 + [1] * 4
+
+LOG_REC_INDEX = 5
+INDEX_ENTRY = struct.Struct("<IIB")
+
+LOG_REC_INDEX_END = 6
+INDEX_END = struct.Struct("<II")
+
+LOG_REC_LATENCY = 7
+LAT_BUCKETS = 20
+LAT_HIST = struct.Struct(f"<III{LAT_BUCKETS}I")  # count, min_us, max_us, log2 us buckets
+LAT_NAMES = ("write", "sync")
+
+LOG_REC_LATENCY_BURST = 12  # PSRAM flush bursts, one histogram
+
+LOG_REC_BARO = 8
+BARO = struct.Struct("<Iff")  # ts_us, pressure, altitude
+
+LOG_REC_BIAS = 9
+BIAS = struct.Struct("<I3f")  # ts_us, gyro_bias
+
+LOG_REC_EVENT = 10
+EVENT = struct.Struct("<IB")  # ts_us, state, then the text
+
+LOG_REC_CONFIG = 11  # "NAME VALUE" text
+
+STATES = ["DIAG", "PREFLT", "NAVLK", "BURN", "COAST", "RECVY", "OVRD"]
+
+REC_SIZES = {LOG_REC_FRAME: FRAME.size, LOG_REC_IMU: IMU.size, LOG_REC_STATS: STATS.size,
+             LOG_REC_INDEX_END: INDEX_END.size, LOG_REC_LATENCY: LAT_HIST.size * len(LAT_NAMES),
+             LOG_REC_BARO: BARO.size, LOG_REC_BIAS: BIAS.size, LOG_REC_LATENCY_BURST: LAT_HIST.size}
+VAR_RECS = {LOG_REC_DELTA, LOG_REC_INDEX, LOG_REC_EVENT, LOG_REC_CONFIG}  # variable length records
+
+
+def fmt_fixed(q, decimals):
+    # Prints a quantized delta field exactly, like %.Nf on the value. Negative
+    # values are one below their count of 10^-decimals, so -0.000 survives
+    sign = "-" if q < 0 else ""
+    whole, frac = divmod(abs(q + 1) if q < 0 else q, 10 ** decimals)
+    return f"{sign}{whole}.{frac:0{decimals}d}"
+
+
+def fmt_bucket(b):
+    """Range label of latency histogram bucket b."""
+    lo = 0 if b == 0 else 1 << b
+    if b == LAT_BUCKETS - 1:
+        return f">= {lo}us"
+    return f"{lo}-{(1 << (b + 1)) - 1}us"
+
+
+def read_varint(data, pos):
+    v = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return v, pos
+
+
+class DeltaDecoder:
+    """Streaming decompressor for LOG_REC_DELTA, fed every frame record in file order."""
+
+    def __init__(self):
+        self.ref = None
+
+    def key(self, payload):
+        v = FRAME.unpack(payload)
+        self.ts, self.state = v[0], v[1]
+        if not all(abs(x * s) < DELTA_LIMIT for x, s in zip(v[2:], DELTA_SCALE)):
+            self.ref = None  # NaN, inf or huge, the logger restarts the chain with the next keyframe
+            return
+        # Exact product, round half to even, same as the logger's lrint()
+        self.ref = [round(x * s) - (math.copysign(1, x) < 0) for x, s in zip(v[2:], DELTA_SCALE)]
+
+    def delta(self, payload, ctx):
+        if self.ref is None:
+            return None  # no keyframe yet, e.g. after a lost block
+
+        dt, pos = read_varint(payload, 0)
+        mask = payload[pos] | (payload[pos + 1] << 8)
+        pos += 2
+        for i in range(len(self.ref)):
+            if mask & (1 << i):
+                z, pos = read_varint(payload, pos)
+                self.ref[i] += (z >> 1) ^ -(z & 1)
+        self.ts += dt
+
+        return fields_to_json(self.ts, self.state,
+                              [fmt_fixed(q, d) for q, d in zip(self.ref, FIELD_DECIMALS)], ctx)
+
+
+class Carried:
+    """Latest baro and bias values, pre-formatted, merged into every frame."""
+
+    def __init__(self):
+        self.pressure = self.altitude = "0.000"
+        self.bias = ["0.000"] * 3
+
+    def baro(self, payload):
+        _, pressure, altitude = BARO.unpack(payload)
+        self.pressure, self.altitude = f"{pressure:.3f}", f"{altitude:.3f}"
+
+    def gyro_bias(self, payload):
+        self.bias = [f"{x:.3f}" for x in BIAS.unpack(payload)[1:]]
+
+
+class MicrosClock:
+    """Unwraps the 32 bit micros() stamps of IMU and event records, which wrap
+    every 71.6 minutes, onto the millis() timeline of the frames. Each stamp is
+    placed within half a wrap of the last frame, or of the previous stamp
+    before the first frame, so pre-trigger samples queued after liftoff land
+    before it rather than a wrap later."""
+
+    def __init__(self):
+        self.ref = None
+        self.anchored = False
+
+    def frame(self, ms):
+        self.ref = ms * 1000
+        self.anchored = True
+
+    def unwrap(self, ts):
+        if self.ref is not None:
+            ts += (self.ref - ts + (1 << 31)) >> 32 << 32
+        if not self.anchored:
+            self.ref = ts
+        return ts
+
+
+def fields_to_json(ts, state, f, ctx):
+    # Same layout and precision as serializer() in src/log.cpp
+    return (
+        f'{{"timestamp":{ts},"state":{state},'
+        f'"raw_accel":[{f[0]},{f[1]},{f[2]}],'
+        f'"raw_gyro":[{f[3]},{f[4]},{f[5]}],'
+        f'"pressure":{ctx.pressure},"altitude":{ctx.altitude},'
+        f'"quats":[{f[6]},{f[7]},{f[8]},{f[9]}],'
+        f'"servo":[{f[10]},{f[11]},{f[12]},{f[13]}],'
+        f'"gyro_bias":[{ctx.bias[0]},{ctx.bias[1]},{ctx.bias[2]}]}}'
+    )
+
+
+def frame_to_json(payload, ctx):
+    v = FRAME.unpack(payload)
+    f = [f"{x:.{d}f}" for x, d in zip(v[2:], FIELD_DECIMALS)]
+    return fields_to_json(v[0], v[1], f, ctx)
+
+
+def check_block(data, pos):
+    """Returns (seq, file_id, version, payload) if an intact block starts at pos, else None."""
+    if pos + BLOCK_SIZE > len(data):
+        return None
+    magic, seq, file_id, length, version, crc = BLOCK_HDR.unpack_from(data, pos)
+    if magic != BLOCK_MAGIC or length > BLOCK_PAYLOAD:
+        return None
+    payload = data[pos + BLOCK_HDR.size:pos + BLOCK_HDR.size + length]
+    if zlib.crc32(payload, zlib.crc32(data[pos:pos + BLOCK_HDR.size - 4])) != crc:
+        return None
+    return seq, file_id, version, payload
+
+
+def scan_blocks(data, report=None, pos=0, file_id=None):
+    """Yields (offset, seq, payload) for every intact block of the log in file order.
+
+    Blocks sit on 512 byte boundaries. When an aligned block fails, the scan
+    slides to the next magic so data shifted by a bad copy is still found.
+    A preallocated file can still hold sectors of an older log, so the scan
+    locks onto the file_id of the first current version block (unless one is
+    given) and skips blocks of any other file or version."""
+    while pos + BLOCK_SIZE <= len(data):
+        blk = check_block(data, pos)
+        if blk is not None:
+            seq, blk_id, version, payload = blk
+            if file_id is None and version == LOG_VERSION:
+                file_id = blk_id
+            if version == LOG_VERSION and blk_id == file_id:
+                yield pos, seq, payload
+            elif report is not None:
+                report["stale"] = report.get("stale", 0) + 1
+            pos += BLOCK_SIZE
+            continue
+
+        if report is not None and data[pos:pos + 4] == BLOCK_MAGIC.to_bytes(4, "little"):
+            report["bad_crc"] = report.get("bad_crc", 0) + 1
+
+        nxt = data.find(BLOCK_MAGIC.to_bytes(4, "little"), pos + 1)
+        if nxt < 0:
+            break
+        pos = nxt
+
+
+def read_blocks(data, report=None):
+    """Intact blocks in sequence order, duplicates removed."""
+    blocks = {}
+    for _, seq, payload in scan_blocks(data, report):
+        blocks.setdefault(seq, payload)
+    return sorted(blocks.items())
+
+
+def block_records(payload):
+    pos = 0
+    while pos + REC_HDR.size <= len(payload):
+        rtype, rlen = REC_HDR.unpack_from(payload, pos)
+        if rtype not in VAR_RECS and REC_SIZES.get(rtype) != rlen:
+            break  # CRC passed, so this only happens with a newer firmware
+        pos += REC_HDR.size
+        yield rtype, payload[pos:pos + rlen]
+        pos += rlen
+
+
+def read_records(data, report=None, start_seq=None):
+    """Yields (type, payload). (None, None) marks lost blocks before the next record.
+
+    Without start_seq the whole file is scanned and put in sequence order.
+    With start_seq reading begins at that block's offset and stays lazy, so
+    a caller that stops early never touches the rest of the file."""
+    if start_seq is None:
+        blocks = read_blocks(data, report)
+    else:
+        blocks = ((seq, payload) for _, seq, payload in scan_blocks(data, report, start_seq * BLOCK_SIZE))
+
+    prev = None
+    for seq, payload in blocks:
+        if prev is not None and seq != prev + 1:
+            if report is not None:
+                report.setdefault("gaps", []).append((prev + 1, seq - 1))
+            yield None, None
+        prev = seq
+
+        yield from block_records(payload)
+
+
+def load_index(data):
+    """Reads the seek index of a closed log from its tail. Returns a list of
+    (seq, timestamp_ms, state), or None if the log was never closed."""
+    last = (len(data) // BLOCK_SIZE - 1) * BLOCK_SIZE
+    blk = check_block(data, last) if last >= 0 else None
+    if blk is None or blk[2] != LOG_VERSION:
+        return None
+    file_id = blk[1]
+
+    end = None
+    for rtype, payload in block_records(blk[3]):
+        if rtype == LOG_REC_INDEX_END:
+            end = INDEX_END.unpack(payload)
+    if end is None:
+        return None
+
+    first_seq, count = end
+    entries = []
+    for _, _, payload in scan_blocks(data, None, first_seq * BLOCK_SIZE, file_id):
+        for rtype, rec in block_records(payload):
+            if rtype == LOG_REC_INDEX:
+                entries += [INDEX_ENTRY.unpack_from(rec, i) for i in range(0, len(rec), INDEX_ENTRY.size)]
+        if len(entries) >= count:
+            break
+    return entries
+
+
+def find_window(index, state=None, t_from=None, t_to=None):
+    """Turns a state name or time window into (start_seq, t_from, t_to) using the index."""
+    if state is not None:
+        code = STATES.index(state)
+        hits = [i for i, e in enumerate(index) if e[2] == code]
+        if not hits:
+            raise ValueError(f"state {state} never reached in this log")
+        t_from = index[hits[0]][1]
+        later = [e for e in index[hits[0]:] if e[2] != code]
+        t_to = later[0][1] - 1 if later else None
+
+    start = index[0][0] if index else 0
+    for seq, ts, _ in index:
+        if t_from is not None and ts <= t_from:
+            start = seq
+    return start, t_from, t_to
+
+
+def frame_ts(line):
+    return int(line[len('{"timestamp":'):line.index(",")])
+
+
+def imu_counts(rec):
+    """ts_us, the six axes in 16 bit counts, 20 bit samples get a fraction, and the die temperature in C."""
+    ts, lsb = rec[0], rec[7:10]
+    axes = []
+    for i in range(3):
+        lo = lsb[i] >> 4
+        axes.append(rec[1 + i] + lo / 16 if lo else rec[1 + i])
+    for i in range(3):
+        lo = lsb[i] & 0x0F
+        axes.append(rec[4 + i] + lo / 16 if lo else rec[4 + i])
+    return (ts, *axes, 25 + rec[10] / 2)
+
+
+def imu_samples(data):
+    """imu_counts() of every IMU record in file order, ts_us unwrapped against the frames like decode() does."""
+    clock = MicrosClock()
+    deltas = DeltaDecoder()
+    ctx = Carried()
+    for rtype, payload in read_records(data):
+        if rtype is None:
+            deltas.ref = None
+        elif rtype == LOG_REC_FRAME:
+            deltas.key(payload)
+            clock.frame(deltas.ts)
+        elif rtype == LOG_REC_DELTA:
+            if deltas.delta(payload, ctx) is not None:
+                clock.frame(deltas.ts)
+        elif rtype == LOG_REC_IMU:
+            smp = imu_counts(IMU.unpack(payload))
+            yield (clock.unwrap(smp[0]), *smp[1:])
+
+
+def decode(data, out, imu_out=None, start_seq=None, t_from=None, t_to=None, events_out=None, config_out=None):
+    imu = []
+    clock = MicrosClock()
+    deltas = DeltaDecoder()
+    ctx = Carried()
+    if events_out is not None:
+        events_out.write("ts_us,state,event\n")
+    out.write("[\n")
+    first = True
+    for rtype, payload in read_records(data, start_seq=start_seq):
+        line = None
+        if rtype is None:
+            deltas.ref = None  # delta chain broken, wait for the next keyframe
+        elif rtype == LOG_REC_FRAME:
+            deltas.key(payload)
+            line = frame_to_json(payload, ctx)
+        elif rtype == LOG_REC_DELTA:
+            line = deltas.delta(payload, ctx)
+        elif rtype == LOG_REC_BARO:
+            ctx.baro(payload)
+        elif rtype == LOG_REC_BIAS:
+            ctx.gyro_bias(payload)
+        elif rtype == LOG_REC_EVENT:
+            ts, state = EVENT.unpack_from(payload)
+            ts = clock.unwrap(ts)
+            if (events_out is not None and (t_from is None or ts // 1000 >= t_from) and
+                    (t_to is None or ts // 1000 <= t_to)):
+                name = STATES[state] if state < len(STATES) else state
+                text = payload[EVENT.size:].decode("ascii", "replace")
+                events_out.write(f'{ts},{name},"{text}"\n')
+        elif rtype == LOG_REC_CONFIG:
+            if config_out is not None:
+                config_out.write(payload.decode("ascii", "replace") + "\n")
+        elif rtype == LOG_REC_IMU:
+            smp = imu_counts(IMU.unpack(payload))
+            imu.append((clock.unwrap(smp[0]), *smp[1:]))
+        elif rtype == LOG_REC_STATS:
+            footer = dict(zip(STATS_FIELDS, STATS.unpack(payload)))
+            sys.stderr.write("log footer: " + ", ".join(f"{k}={v}" for k, v in footer.items()) + "\n")
+        elif rtype == LOG_REC_LATENCY or rtype == LOG_REC_LATENCY_BURST:
+            names = LAT_NAMES if rtype == LOG_REC_LATENCY else ("burst",)
+            for i, name in enumerate(names):
+                count, lo, hi, *buckets = LAT_HIST.unpack_from(payload, i * LAT_HIST.size)
+                sys.stderr.write(f"card {name}: n={count} min={lo}us max={hi}us\n")
+                for b, n in enumerate(buckets):
+                    if n:
+                        sys.stderr.write(f"  {fmt_bucket(b):>16} {n}\n")
+
+        if line is None:
+            continue
+        ts = frame_ts(line)
+        clock.frame(ts)
+        if t_from is not None and ts < t_from:
+            continue
+        if t_to is not None and ts > t_to:
+            break
+        if not first:
+            out.write(",\n")
+        out.write(line)
+        first = False
+    out.write("\n]\n")
+
+    # Pre-trigger samples are queued after liftoff and overlap the full rate
+    # stream from ARM onwards, put them back in time order without duplicates.
+    # Stamps are unwrapped, so they keep counting past the 32 bit micros() wrap
+    if imu_out is not None:
+        imu_out.write("ts_us,ax,ay,az,gx,gy,gz,temp_c\n")
+        for smp in sorted(dict((s[0], s) for s in imu).values(), key=lambda s: s[0]):
+            if (t_from is not None and smp[0] // 1000 < t_from) or (t_to is not None and smp[0] // 1000 > t_to):
+                continue
+            imu_out.write(",".join(str(v) for v in smp) + "\n")
+
+
+if __name__ == "__main__":
+    ap = argparse.ArgumentParser(description="Decode a RACS binary flight log to the JSON frame schema")
+    ap.add_argument("log")
+    ap.add_argument("out", nargs="?", help="JSON output, stdout if omitted")
+    ap.add_argument("--imu", help="also write raw IMU samples to this CSV")
+    ap.add_argument("--events", help="also write state transitions and other events to this CSV")
+    ap.add_argument("--config", help="also write the config snapshot taken at ARM to this file")
+    ap.add_argument("--index", action="store_true", help="print the seek index and exit")
+    ap.add_argument("--state", choices=STATES, help="only decode the first stretch of this flight state")
+    ap.add_argument("--from", dest="t_from", type=int, help="start of the time window, ms")
+    ap.add_argument("--to", dest="t_to", type=int, help="end of the time window, ms")
+    args = ap.parse_intermixed_args()
+
+    with open(args.log, "rb") as f:
+        raw = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    index = load_index(raw)
+
+    if args.index:
+        if index is None:
+            sys.exit("no index, log was not closed (decode it in full instead)")
+        for seq, ts, state in index:
+            print(f"{ts:>10} ms  {STATES[state] if state < len(STATES) else state:<7} block {seq}")
+        sys.exit(0)
+
+    start_seq, t_from, t_to = None, args.t_from, args.t_to
+    if args.state or t_from is not None or t_to is not None:
+        if index is None:
+            sys.stderr.write("no index, scanning the whole log\n")
+            if args.state:
+                sys.exit("--state needs the index of a closed log")
+        else:
+            start_seq, t_from, t_to = find_window(index, args.state, t_from, t_to)
+
+    imu_out = open(args.imu, "w") if args.imu else None
+    events_out = open(args.events, "w") if args.events else None
+    config_out = open(args.config, "w") if args.config else None
+    out = open(args.out, "w") if args.out else sys.stdout
+
+    decode(raw, out, imu_out, start_seq, t_from, t_to, events_out, config_out)
+
+    for f in (imu_out, events_out, config_out):
+        if f:
+            f.close()
+    if out is not sys.stdout:
+        out.close()
@@ -15,13 +15,29 @@ bool baro_init()
     return true;
 }
 
-void baro_read(FltData_t *fltdata)
+static bool sample_waiting = false; // status said a sample is ready, read on the next baro_read()
+
+// The DPS310 driver only does blocking I2C, so reads are split in two phases
+// on different control ticks and no tick pays for both the status poll and
+// the data read
+bool baro_read_start()
 {
-    if (dps.temperatureAvailable() && dps.pressureAvailable()){
-        sensors_event_t temp_evt, pressure_evt;
+    if (!sample_waiting)
+        sample_waiting = dps.temperatureAvailable() && dps.pressureAvailable();
+    return sample_waiting;
+}
 
-        dps.getEvents(&temp_evt, &pressure_evt);
+// Returns true if a new sample was read
+bool baro_read(FltData_t *fltdata)
+{
+    if (!sample_waiting)
+        return false;
+    sample_waiting = false;
 
-        fltdata->pressure = pressure_evt.pressure;
-    }
+    sensors_event_t temp_evt, pressure_evt;
+
+    dps.getEvents(&temp_evt, &pressure_evt);
+
+    fltdata->pressure = pressure_evt.pressure;
+    return true;
 }
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include "log.h"
 #include "nav.h"
+#include "imu.h"
 #include "eeprom_config.h"
 #include "comms.h"
 
@@ -11,9 +12,25 @@ static uint32_t last_print_time = 0;
 static char cmd_buf[64];
 static uint8_t cmd_idx = 0;
 
+// Log download. Every DAT line carries its file offset, base64 data and the
+// CRC32 of the raw bytes, so it interleaves safely with other output and a
+// damaged or lost line costs one resend from that offset, not a restart
+#define DL_CHUNK 192                        // raw bytes per DAT line, 256 base64 chars
+#define DL_LINE_MAX (16 + DL_CHUNK * 4 / 3 + 12) // "DAT: <offset> <b64> <crc>"
+
+static uint8_t tx_extra[2048]; // Serial1 TX buffer headroom for the download stream
+
+static bool dl_active = false;
+static char dl_name[32];
+static uint32_t dl_size = 0;
+static uint32_t dl_offset = 0;       // next byte to send
+static uint32_t dl_start_offset = 0; // resume point of this transfer
+static uint32_t dl_start_time = 0;
+
 typedef enum
 {
     T_F32,
+    T_F32G, // float printed with %g, for model coefficients far below 0.001
     T_U32,
     T_BOOL
 } VarType_t;
@@ -44,21 +61,105 @@ const ConfigEntry_t config_table[] = {
     {"SERVO_CENTER_US", &config.servo_center_us, T_F32},
     {"SERVO_FLT_LIM_DEG", &config.servo_limit_max_deg, T_F32},
     {"SERVO_US_PER_DEG", &config.servo_us_per_deg, T_F32},
+    {"IMU_STILL_ACCEL_MS2", &config.imu_still_accel_ms2, T_F32},
+    {"IMU_STILL_GYRO_DPS", &config.imu_still_gyro_dps, T_F32},
+
+    {"IMU_TC_AX_B0", &config.imu_tc_accel[0][0], T_F32G},
+    {"IMU_TC_AX_B1", &config.imu_tc_accel[0][1], T_F32G},
+    {"IMU_TC_AX_B2", &config.imu_tc_accel[0][2], T_F32G},
+    {"IMU_TC_AX_K1", &config.imu_tc_accel[0][3], T_F32G},
+    {"IMU_TC_AX_K2", &config.imu_tc_accel[0][4], T_F32G},
+    {"IMU_TC_AY_B0", &config.imu_tc_accel[1][0], T_F32G},
+    {"IMU_TC_AY_B1", &config.imu_tc_accel[1][1], T_F32G},
+    {"IMU_TC_AY_B2", &config.imu_tc_accel[1][2], T_F32G},
+    {"IMU_TC_AY_K1", &config.imu_tc_accel[1][3], T_F32G},
+    {"IMU_TC_AY_K2", &config.imu_tc_accel[1][4], T_F32G},
+    {"IMU_TC_AZ_B0", &config.imu_tc_accel[2][0], T_F32G},
+    {"IMU_TC_AZ_B1", &config.imu_tc_accel[2][1], T_F32G},
+    {"IMU_TC_AZ_B2", &config.imu_tc_accel[2][2], T_F32G},
+    {"IMU_TC_AZ_K1", &config.imu_tc_accel[2][3], T_F32G},
+    {"IMU_TC_AZ_K2", &config.imu_tc_accel[2][4], T_F32G},
+
+    {"IMU_TC_GX_B0", &config.imu_tc_gyro[0][0], T_F32G},
+    {"IMU_TC_GX_B1", &config.imu_tc_gyro[0][1], T_F32G},
+    {"IMU_TC_GX_B2", &config.imu_tc_gyro[0][2], T_F32G},
+    {"IMU_TC_GX_K1", &config.imu_tc_gyro[0][3], T_F32G},
+    {"IMU_TC_GX_K2", &config.imu_tc_gyro[0][4], T_F32G},
+    {"IMU_TC_GY_B0", &config.imu_tc_gyro[1][0], T_F32G},
+    {"IMU_TC_GY_B1", &config.imu_tc_gyro[1][1], T_F32G},
+    {"IMU_TC_GY_B2", &config.imu_tc_gyro[1][2], T_F32G},
+    {"IMU_TC_GY_K1", &config.imu_tc_gyro[1][3], T_F32G},
+    {"IMU_TC_GY_K2", &config.imu_tc_gyro[1][4], T_F32G},
+    {"IMU_TC_GZ_B0", &config.imu_tc_gyro[2][0], T_F32G},
+    {"IMU_TC_GZ_B1", &config.imu_tc_gyro[2][1], T_F32G},
+    {"IMU_TC_GZ_B2", &config.imu_tc_gyro[2][2], T_F32G},
+    {"IMU_TC_GZ_K1", &config.imu_tc_gyro[2][3], T_F32G},
+    {"IMU_TC_GZ_K2", &config.imu_tc_gyro[2][4], T_F32G},
+
+    {"IMU_CAL_AX_X", &config.imu_cal_accel[0][0], T_F32G},
+    {"IMU_CAL_AX_Y", &config.imu_cal_accel[0][1], T_F32G},
+    {"IMU_CAL_AX_Z", &config.imu_cal_accel[0][2], T_F32G},
+    {"IMU_CAL_AX_OFS", &config.imu_cal_accel[0][3], T_F32G},
+    {"IMU_CAL_AY_X", &config.imu_cal_accel[1][0], T_F32G},
+    {"IMU_CAL_AY_Y", &config.imu_cal_accel[1][1], T_F32G},
+    {"IMU_CAL_AY_Z", &config.imu_cal_accel[1][2], T_F32G},
+    {"IMU_CAL_AY_OFS", &config.imu_cal_accel[1][3], T_F32G},
+    {"IMU_CAL_AZ_X", &config.imu_cal_accel[2][0], T_F32G},
+    {"IMU_CAL_AZ_Y", &config.imu_cal_accel[2][1], T_F32G},
+    {"IMU_CAL_AZ_Z", &config.imu_cal_accel[2][2], T_F32G},
+    {"IMU_CAL_AZ_OFS", &config.imu_cal_accel[2][3], T_F32G},
+
+    {"IMU_CAL_GX_X", &config.imu_cal_gyro[0][0], T_F32G},
+    {"IMU_CAL_GX_Y", &config.imu_cal_gyro[0][1], T_F32G},
+    {"IMU_CAL_GX_Z", &config.imu_cal_gyro[0][2], T_F32G},
+    {"IMU_CAL_GX_OFS", &config.imu_cal_gyro[0][3], T_F32G},
+    {"IMU_CAL_GY_X", &config.imu_cal_gyro[1][0], T_F32G},
+    {"IMU_CAL_GY_Y", &config.imu_cal_gyro[1][1], T_F32G},
+    {"IMU_CAL_GY_Z", &config.imu_cal_gyro[1][2], T_F32G},
+    {"IMU_CAL_GY_OFS", &config.imu_cal_gyro[1][3], T_F32G},
+    {"IMU_CAL_GZ_X", &config.imu_cal_gyro[2][0], T_F32G},
+    {"IMU_CAL_GZ_Y", &config.imu_cal_gyro[2][1], T_F32G},
+    {"IMU_CAL_GZ_Z", &config.imu_cal_gyro[2][2], T_F32G},
+    {"IMU_CAL_GZ_OFS", &config.imu_cal_gyro[2][3], T_F32G},
 
     {"PARACHUTE_TIMEOUT_FROM_IGN_MS", &config.parachute_charge_timeout_ms, T_U32},
     {"MOTOR_BURN_MS", &config.motor_burn_time_ms, T_U32},
 
-    {"LOG_RATE_MS", &config.log_interval_ms, T_U32},
+    {"LOG_RATE_DIAG_MS", &config.log_rate_ms[STATE_DIAG], T_U32},
+    {"LOG_RATE_PREFLT_MS", &config.log_rate_ms[STATE_PREFLT], T_U32},
+    {"LOG_RATE_NAVLK_MS", &config.log_rate_ms[STATE_NAVLK], T_U32},
+    {"LOG_RATE_BURN_MS", &config.log_rate_ms[STATE_BURN], T_U32},
+    {"LOG_RATE_COAST_MS", &config.log_rate_ms[STATE_COAST], T_U32},
+    {"LOG_RATE_RECVY_MS", &config.log_rate_ms[STATE_RECVY], T_U32},
+    {"LOG_RATE_OVRD_MS", &config.log_rate_ms[STATE_OVRD], T_U32},
     {"LOG_FLUSH_MS", &config.log_flush_interval_ms, T_U32},
+    {"LOG_PREALLOC_MB", &config.log_prealloc_mb, T_U32},
+    {"LOG_CLOSE_DELAY_MS", &config.log_close_delay_ms, T_U32},
+    {"LOG_PSRAM_FLUSH_DELAY_MS", &config.log_psram_flush_delay_ms, T_U32},
+    {"IMU_FIFO_WM", &config.imu_fifo_wm, T_U32}, // IMU mode settings are read by imu_init(), take effect after SAVE and a reboot
+    {"IMU_ODR_HZ", &config.imu_odr_hz, T_U32},
 
     {"SERVO_BURN_EN", &config.en_servo_in_burn, T_BOOL},
+    {"LOG_IMU_RAW_EN", &config.log_imu_raw_en, T_BOOL},
+    {"LOG_COMPRESS_EN", &config.log_compress_en, T_BOOL},
+    {"LOG_PSRAM_EN", &config.log_psram_en, T_BOOL},
+    {"IMU_FIFO_HIRES_EN", &config.imu_fifo_hires_en, T_BOOL}, // after SAVE and a reboot, like IMU_FIFO_WM
+    {"IMU_IRQ_EN", &config.imu_irq_en, T_BOOL},               // after SAVE and a reboot, like IMU_FIFO_WM
     {"INVERTED_TEST_EN", &config.test_mode_en, T_BOOL}};
 
 const size_t NUM_CONFIG_ENTRIES = sizeof(config_table) / sizeof(config_table[0]);
 
+void comms_init()
+{
+    Serial1.addMemoryForWrite(tx_extra, sizeof(tx_extra));
+}
+
 // TELEM ONLY SENT TO USB ACM
 void comms_send_telem(FltStates_t state, FltData_t *fltdata)
 {
+    if (dl_active) // the link has no bandwidth to spare during a download
+        return;
+
     if ((state == STATE_OVRD || state == STATE_PREFLT) &&
         (millis() - last_print_time >= 100))
     {
@@ -76,13 +177,131 @@ void comms_send_telem(FltStates_t state, FltData_t *fltdata)
     }
 }
 
+static size_t base64_encode(const uint8_t *in, size_t len, char *out)
+{
+    static const char tab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *p = out;
+
+    for (size_t i = 0; i < len; i += 3)
+    {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len)
+            v |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len)
+            v |= in[i + 2];
+
+        *p++ = tab[(v >> 18) & 0x3F];
+        *p++ = tab[(v >> 12) & 0x3F];
+        *p++ = (i + 1 < len) ? tab[(v >> 6) & 0x3F] : '=';
+        *p++ = (i + 2 < len) ? tab[v & 0x3F] : '=';
+    }
+    return p - out;
+}
+
+static void dl_stop(const char *why)
+{
+    log_dl_close();
+    dl_active = false;
+    Serial1.printf("GET: %s %s\n", why, dl_name);
+}
+
+// Sends at most one chunk per call and only when it fits in the TX buffer,
+// so the loop never waits on the radio
+static void dl_pump(FltStates_t state)
+{
+    if (!dl_active)
+        return;
+
+    if (state == STATE_NAVLK || state == STATE_BURN || state == STATE_COAST || state == STATE_RECVY)
+    {
+        dl_stop("ABORT");
+        return;
+    }
+
+    if (dl_offset >= dl_size)
+    {
+        // Transfer time as seen by the FC, the host reports its own as well
+        Serial1.printf("GET: END %s %lu %lu\n", dl_name, dl_size - dl_start_offset, millis() - dl_start_time);
+        log_dl_close();
+        dl_active = false;
+        return;
+    }
+
+    if (Serial1.availableForWrite() < DL_LINE_MAX)
+        return;
+
+    uint8_t raw[DL_CHUNK];
+    uint32_t n = (dl_size - dl_offset < DL_CHUNK) ? dl_size - dl_offset : DL_CHUNK;
+
+    if (log_dl_read(dl_offset, raw, n) != (int)n)
+    {
+        dl_stop("ERROR");
+        return;
+    }
+
+    char line[DL_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "DAT: %lu ", dl_offset);
+    len += base64_encode(raw, n, line + len);
+    len += snprintf(line + len, sizeof(line) - len, " %08lX\n", log_crc32(raw, n));
+
+    Serial1.write((const uint8_t *)line, len);
+    dl_offset += n;
+}
+
+// "NAME VALUE" text of one tunable, as printed by DUMP
+static void config_entry_str(size_t i, char *buf, size_t buf_size)
+{
+    if (config_table[i].type == T_F32)
+        snprintf(buf, buf_size, "%s %.3f", config_table[i].name, *(float *)config_table[i].ptr);
+    else if (config_table[i].type == T_F32G)
+        snprintf(buf, buf_size, "%s %g", config_table[i].name, *(float *)config_table[i].ptr);
+    else if (config_table[i].type == T_U32)
+        snprintf(buf, buf_size, "%s %lu", config_table[i].name, *(uint32_t *)config_table[i].ptr);
+    else
+        snprintf(buf, buf_size, "%s %d", config_table[i].name, *(bool *)config_table[i].ptr);
+}
+
+// Snapshot of every tunable into the log, so a flight log records what it flew with
+static void config_log_snapshot()
+{
+    char line[64];
+
+    snprintf(line, sizeof(line), "CFG_MAGIC 0x%08lX", (unsigned long)CFG_MAGIC);
+    log_write_config(line);
+
+    for (size_t i = 0; i < NUM_CONFIG_ENTRIES; i++)
+    {
+        config_entry_str(i, line, sizeof(line));
+        log_write_config(line);
+    }
+}
+
+// Two lines per histogram, summary then the log2 us buckets
+static void print_latency(const char *name, const LogLatHist_t *h)
+{
+    Serial1.printf("STAT: %s_US N %lu MIN %lu MAX %lu\n", name, h->count, h->min_us, h->max_us);
+    Serial1.printf("STAT: %s_HIST", name);
+    for (int i = 0; i < LOG_LAT_BUCKETS; i++)
+        Serial1.printf(" %lu", h->bucket[i]);
+    Serial1.println();
+}
+
 static void cmd_processor(char *cmd_str, FltStates_t *state)
 {
     bool flt_lockout_en = (*state == STATE_NAVLK || *state == STATE_BURN || *state == STATE_COAST || *state == STATE_RECVY);
 
     if (flt_lockout_en)
     {
-        Serial1.println("MSG: COMMAND IGNORED IN FLIGHT LOCKOUT");
+        // A retrying ground station must not push flight events out of the
+        // journal, only one rejection a second gets journaled
+        static uint32_t last_lockout_event = 0;
+        if (last_lockout_event == 0 || millis() - last_lockout_event >= 1000)
+        {
+            log_event(*state, "COMMAND IGNORED IN FLIGHT LOCKOUT");
+            last_lockout_event = millis();
+        }
+        else
+            Serial1.println("MSG: COMMAND IGNORED IN FLIGHT LOCKOUT");
         return;
     }
 
@@ -96,25 +315,32 @@ static void cmd_processor(char *cmd_str, FltStates_t *state)
     {
         *state = STATE_NAVLK;
         nav_rst_integral();
-        Serial1.println("MSG: GUIDANCE IS INTERNAL");
+        config_log_snapshot();
+        if (imu_bias_windows() == 0)
+            log_event(*state, "GYRO BIAS NOT CALIBRATED, PAD NEVER STILL");
+        if (log_capture_start())
+            log_event(*state, "PSRAM CAPTURE STARTED");
+        log_event(*state, "GUIDANCE IS INTERNAL");
     }
     else if (strcmp(cmd, "OVRD") == 0)
     {
         *state = STATE_OVRD;
         nav_rst_integral();
-        Serial1.println("MSG: GROUND OVERRIDE MODE");
+        log_capture_flush(); // back on the ground
+        log_event(*state, "GROUND OVERRIDE MODE");
     }
     else if (strcmp(cmd, "PREFLT") == 0)
     {
         *state = STATE_PREFLT;
-        Serial1.println("MSG: REVERTED TO PREFLT");
+        log_capture_flush();
+        log_event(*state, "REVERTED TO PREFLT");
     }
 
     else if (strcmp(cmd, "SET") == 0)
     {
         if (!arg1 || !arg2)
         {
-            Serial1.println("MSG: SYNTAX ERROR. USE: SET <VAR> <VALUE>");
+            log_event(*state, "SYNTAX ERROR. USE: SET <VAR> <VALUE>");
             return;
         }
 
@@ -128,58 +354,128 @@ static void cmd_processor(char *cmd_str, FltStates_t *state)
                 if (config_table[i].type == T_F32)
                 {
                     *(float *)config_table[i].ptr = atof(arg2);
-                    Serial1.printf("MSG: %s = %.3f\n", config_table[i].name, *(float *)config_table[i].ptr);
+                    log_event(*state, "%s = %.3f", config_table[i].name, *(float *)config_table[i].ptr);
+                }
+                else if (config_table[i].type == T_F32G)
+                {
+                    *(float *)config_table[i].ptr = atof(arg2);
+                    log_event(*state, "%s = %g", config_table[i].name, *(float *)config_table[i].ptr);
                 }
                 else if (config_table[i].type == T_U32)
                 {
                     *(uint32_t *)config_table[i].ptr = strtoul(arg2, NULL, 10);
-                    Serial1.printf("MSG: %s = %lu\n", config_table[i].name, *(uint32_t *)config_table[i].ptr);
+                    log_event(*state, "%s = %lu", config_table[i].name, *(uint32_t *)config_table[i].ptr);
                 }
                 else if (config_table[i].type == T_BOOL)
                 {
                     *(bool *)config_table[i].ptr = atoi(arg2) > 0;
-                    Serial1.printf("MSG: %s = %d\n", config_table[i].name, *(bool *)config_table[i].ptr);
+                    log_event(*state, "%s = %d", config_table[i].name, *(bool *)config_table[i].ptr);
                 }
 
+                imu_cal_update(); // calibration or test mode may have changed
                 found = true;
                 break;
             }
         }
         if (!found)
-            Serial1.println("MSG: UNKNOWN TUNEABLE VARIABLE");
+            log_event(*state, "UNKNOWN TUNEABLE VARIABLE");
     }
 
     else if (strcmp(cmd, "DUMP") == 0)
     {
 
+        char line[64];
+
         for (size_t i = 0; i < NUM_CONFIG_ENTRIES; i++)
         {
-            if (config_table[i].type == T_F32)
-            {
-                Serial1.printf("CFG: %s %.3f\n", config_table[i].name, *(float *)config_table[i].ptr);
-            }
-            else if (config_table[i].type == T_U32)
-            {
-                Serial1.printf("CFG: %s %lu\n", config_table[i].name, *(uint32_t *)config_table[i].ptr);
-            }
-            else if (config_table[i].type == T_BOOL)
+            config_entry_str(i, line, sizeof(line));
+            Serial1.printf("CFG: %s\n", line);
+        }
+    }
+
+    else if (strcmp(cmd, "STATS") == 0)
+    {
+        const LogStats_t *ls = log_get_stats();
+
+        Serial1.printf("STAT: LOG_OVERFLOWS %lu\n", ls->overflows);
+        Serial1.printf("STAT: LOG_STALLS %lu\n", ls->stalls);
+        Serial1.printf("STAT: LOG_WRITE_ERRORS %lu\n", ls->write_errors);
+        Serial1.printf("STAT: LOG_BLOCKS %lu\n", ls->blocks_written);
+        Serial1.printf("STAT: LOG_RING_MAX %u/%u\n", ls->max_used_blocks, LOG_RING_BLOCKS);
+        Serial1.printf("STAT: IMU_LOGGED %lu\n", ls->imu_logged);
+        Serial1.printf("STAT: IMU_DROPPED %lu\n", ls->imu_dropped);
+        Serial1.printf("STAT: IMU_GAPS %lu\n", ls->imu_gaps);
+        Serial1.printf("STAT: EVENTS_DROPPED %lu\n", ls->events_dropped);
+
+        const LogLatency_t *lat = log_get_latency();
+
+        print_latency("LOG_WRITE", &lat->write);
+        print_latency("LOG_SYNC", &lat->sync);
+        print_latency("LOG_BURST", &lat->burst);
+    }
+
+    else if (strcmp(cmd, "BENCH") == 0)
+    {
+        log_bench_serializer();
+        imu_bench_bus();
+    }
+
+    else if (strcmp(cmd, "LS") == 0)
+    {
+        char name[32];
+        uint32_t size;
+        int count = 0;
+
+        if (log_ls_begin())
+        {
+            while (log_ls_next(name, sizeof(name), &size))
             {
-                Serial1.printf("CFG: %s %d\n", config_table[i].name, *(bool *)config_table[i].ptr);
+                Serial1.printf("FILE: %s %lu\n", name, size);
+                count++;
             }
         }
+        Serial1.printf("FILE: END %d\n", count);
+    }
+
+    // GET <file> [offset] streams the file from offset, GET alone cancels
+    else if (strcmp(cmd, "GET") == 0)
+    {
+        if (dl_active)
+            dl_stop("ABORT");
+
+        if (!arg1)
+            return;
+
+        if (strlen(arg1) >= sizeof(dl_name) || !log_dl_open(arg1, &dl_size))
+        {
+            log_event(*state, "GET FAILED, NO LOG FILE %s", arg1);
+            Serial1.printf("GET: ERROR %s\n", arg1);
+            return;
+        }
+
+        strcpy(dl_name, arg1);
+        dl_offset = arg2 ? strtoul(arg2, NULL, 10) : 0;
+        if (dl_offset > dl_size)
+            dl_offset = dl_size;
+        dl_start_offset = dl_offset;
+        dl_start_time = millis();
+        dl_active = true;
+
+        Serial1.printf("GET: %s %lu %lu\n", dl_name, dl_size, dl_offset);
     }
 
     else if (strcmp(cmd, "SAVE") == 0)
     {
         config_save();
-        Serial1.println("MSG: CONFIG SAVED TO EEPROM");
+        log_event(*state, "CONFIG SAVED TO EEPROM");
     }
 
     else if (strcmp(cmd, "DEFAULT") == 0)
     {
         config_set_defaults();
         config_save();
-        Serial1.println("MSG: EEPROM RESET TO DEFAULTS");
+        imu_cal_update();
+        log_event(*state, "EEPROM RESET TO DEFAULTS");
     }
 
     else if (strcmp(cmd, "MAGICRESET") == 0)
@@ -189,7 +485,7 @@ static void cmd_processor(char *cmd_str, FltStates_t *state)
 
     else
     {
-        Serial1.println("MSG: UNKNOWN COMMAND");
+        log_event(*state, "UNKNOWN COMMAND");
     }
 }
 
@@ -213,4 +509,6 @@ void comms_read_cmd(FltStates_t *state)
             cmd_buf[cmd_idx++] = c;
         }
     }
+
+    dl_pump(*state);
 }
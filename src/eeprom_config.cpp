@@ -17,13 +17,43 @@ void config_set_defaults()
     config.servo_us_per_deg = 10.0f;
     config.servo_limit_max_deg = 30.0f;
 
+    config.imu_still_accel_ms2 = 0.1f; // several times the sensor noise, well under pad handling
+    config.imu_still_gyro_dps = 0.5f;
+
+    memset(config.imu_tc_accel, 0, sizeof(config.imu_tc_accel)); // uncalibrated, no correction
+    memset(config.imu_tc_gyro, 0, sizeof(config.imu_tc_gyro));
+
+    memset(config.imu_cal_accel, 0, sizeof(config.imu_cal_accel));
+    memset(config.imu_cal_gyro, 0, sizeof(config.imu_cal_gyro));
+    for (int i = 0; i < 3; i++)
+    {
+        config.imu_cal_accel[i][i] = 1.0f;
+        config.imu_cal_gyro[i][i] = 1.0f;
+    }
+
     config.motor_burn_time_ms = 3000;
     config.parachute_charge_timeout_ms = 60000;
 
-    config.log_interval_ms = 10;
-    config.log_flush_interval_ms = 100;
+    config.log_rate_ms[STATE_DIAG] = 100;
+    config.log_rate_ms[STATE_PREFLT] = 200;
+    config.log_rate_ms[STATE_NAVLK] = 10;
+    config.log_rate_ms[STATE_BURN] = 0;
+    config.log_rate_ms[STATE_COAST] = 0;
+    config.log_rate_ms[STATE_RECVY] = 200;
+    config.log_rate_ms[STATE_OVRD] = 10;
+    config.log_flush_interval_ms = 500;
+    config.log_prealloc_mb = 256;
+    config.log_close_delay_ms = 120000;
+    config.log_psram_flush_delay_ms = 10000;
+    config.imu_fifo_wm = 0;
+    config.imu_odr_hz = 1600;
 
     config.en_servo_in_burn = false;
+    config.log_imu_raw_en = true;
+    config.log_compress_en = true;
+    config.log_psram_en = false;
+    config.imu_fifo_hires_en = false;
+    config.imu_irq_en = false;
     config.test_mode_en = false;
 }
 
@@ -2,11 +2,12 @@
 #include "eeprom_config.h"
 #include <math.h>
 #include <Wire.h>
+#include <SPI.h>
 #include <ICM45686.h>
 
 static const uint16_t ACCEL_FSR_G = 16;
 static const uint16_t GYRO_FSR_DPS = 2000;
-static const uint16_t ODR_HZ = 1600;
+static const uint16_t ODR_HZ = 1600; // default and register mode rate, FIFO mode can oversample
 
 static const float G_MS2 = 9.80665f;
 static const float DEG_2_RAD = 3.14159265f / 180.0f;
@@ -14,83 +15,597 @@ static const float DEG_2_RAD = 3.14159265f / 180.0f;
 static const float ACCEL_SCALE = (float)ACCEL_FSR_G / 32768.0f * G_MS2;
 static const float GYRO_SCALE = (float)GYRO_FSR_DPS / 32768.0f * DEG_2_RAD;
 
-static ICM456xx IMU(Wire, 0);
+// 20 bit FIFO data is always at the highest full scale, whatever the FSR setting
+static const uint16_t ACCEL_HIRES_FSR_G = 32;
+static const uint16_t GYRO_HIRES_FSR_DPS = 4000;
+static const float ACCEL_HIRES_SCALE = (float)ACCEL_HIRES_FSR_G / 32768.0f * G_MS2;
+static const float GYRO_HIRES_SCALE = (float)GYRO_HIRES_FSR_DPS / 32768.0f * DEG_2_RAD;
+
+static const uint32_t FIFO_WM_MAX = 255;      // library takes an 8 bit watermark
+
+static const uint32_t BIAS_WINDOW_MS = 500; // stillness is judged over windows this long
+static const uint32_t BIAS_WINDOWS_MAX = 20; // running mean of the first windows, then a ~10s moving average
+
+#ifdef IMU_SPI
+static ICM456xx IMU(SPI1, PIN_IMU_CS, IMU_BUS_HZ);
+static const char *const IMU_BUS_NAME = "SPI";
+#else
+static ICM456xx IMU(Wire, 0, IMU_BUS_HZ);
+static const char *const IMU_BUS_NAME = "I2C";
+#endif
+
+// Samples of the last imu_read(), oldest first
+static ImuSample_t samples[IMU_FIFO_MAX];
+static uint16_t sample_count = 0;
+
+static volatile bool irq_pending = false; // set by INT1, cleared before the read
+static volatile uint32_t irq_us = 0;      // micros() of the last INT1 edge
+static bool fifo_mode = false;            // FIFO watermark drains instead of register reads, set at init
+static bool irq_mode = false;             // INT1 data ready or watermark drives the reads, set at init
+static bool hires = false;                // 20 bit FIFO frames, set at init
+static bool integrate = false;            // FIFO mode, every sample goes into the tick's delta angle
+static uint16_t odr_hz = ODR_HZ;
+static uint32_t last_smp_us = 0;          // timestamp of the last integrated sample
+static float last_da[3];                  // delta angle and velocity of that sample, for the
+static float last_dv[3];                  // two sample coning and sculling terms
+
+// Gyro bias estimator, sums are offset by the window's first sample so the
+// float variances don't cancel against the 1g accel reading
+static float bias_ref[6];
+static float bias_sum[6];
+static float bias_sq[6];
+static uint32_t bias_n = 0;
+static uint32_t bias_windows = 0;
+static bool fifo_synced = false;           // ts_us runs on the FIFO timestamp once anchored to micros()
+static uint16_t fifo_last_tmst = 0;
+static uint32_t fifo_ts_us = 0;
+static uint32_t fifo_drain_us = 0;        // micros() when the current burst was read
+static uint16_t fifo_frames = 0;          // frames in the current burst, set by readFifo() before parsing
+
+// Counts to body axis m/s^2 and rad/s in one 3x4 affine pass per sensor:
+// count scale, temperature model, calibration matrix, mounting and test mode
+// flips folded together. Rebuilt when the 0.5C temperature step or the config
+// changes, so samples only pay for the matrix-vector product.
+static float accel_xf[3][4];
+static float gyro_xf[3][4];
+static int16_t xf_temp = INT16_MIN; // temperature step the transforms were built for, none yet
+
+// 16 bit register or 20 bit FIFO temperature, 1/128C from 25C, to the 0.5C
+// steps of ImuSample_t, clamped to what fits
+static inline int8_t imu_temp(int16_t raw)
+{
+    int32_t half_c = ((int32_t)raw + (raw < 0 ? -32 : 32)) / 64;
+    return (int8_t)(half_c < -128 ? -128 : half_c > 127 ? 127 : half_c);
+}
+
+#ifdef IMU_SPI
+// Background reads. In register mode on the data ready interrupt the sample is
+// clocked out by the SPI DMA while the loop still computes on the previous one,
+// so the loop never waits on the bus.
+static EventResponder dma_done;
+static volatile bool dma_busy = false;   // transfer in flight, the device is off limits
+static volatile bool dma_hold = false;   // blocking access in progress, no new transfers
+static volatile bool latest_new = false;
+static volatile uint32_t dma_ts_us = 0;  // stamp of the sample in flight
+static ImuSample_t latest;               // newest completed background sample
+static ImuSampleCb_t read_cb = NULL;
+
+static void imu_dma_complete(EventResponderRef)
+{
+    inv_imu_sensor_data_t imu_data;
+    IMU.finishDataFromRegisters(imu_data);
+
+    latest.ts_us = dma_ts_us;
+    memcpy(latest.accel, imu_data.accel_data, sizeof(latest.accel));
+    memcpy(latest.gyro, imu_data.gyro_data, sizeof(latest.gyro));
+    memset(latest.lsb, 0, sizeof(latest.lsb));
+    latest.temp = imu_temp(imu_data.temp_data);
+    latest_new = true;
+    dma_busy = false;
+    irq_pending = true; // the loop ticks on the completed read, not the edge
+
+    if (read_cb)
+        read_cb(&latest);
+}
+
+// Caller has claimed the bus by setting dma_busy
+static bool imu_dma_start(uint32_t ts_us)
+{
+    dma_ts_us = ts_us;
+    if (IMU.startDataFromRegisters(dma_done) != 0)
+    {
+        dma_busy = false;
+        return false;
+    }
+    return true;
+}
+#endif
+
+// Register reads on the data ready interrupt go through the DMA in SPI builds
+static bool imu_async()
+{
+#ifdef IMU_SPI
+    return irq_mode && !fifo_mode;
+#else
+    return false;
+#endif
+}
+
+// Blocking library calls must not overlap a background transfer
+static void imu_bus_hold(bool hold)
+{
+#ifdef IMU_SPI
+    dma_hold = hold;
+    while (hold && dma_busy)
+        ;
+#endif
+}
+
+static void imu_isr()
+{
+    irq_us = micros();
+#ifdef IMU_SPI
+    if (imu_async())
+    {
+        if (!dma_busy && !dma_hold)
+        {
+            dma_busy = true;
+            imu_dma_start(irq_us);
+        }
+        return;
+    }
+#endif
+    irq_pending = true;
+}
+
+// Takes the pending INT1 edge, false if there was none
+static bool imu_take_irq(uint32_t *ts_us)
+{
+    noInterrupts();
+    bool pending = irq_pending;
+    irq_pending = false;
+    *ts_us = irq_us;
+    interrupts();
+    return pending;
+}
+
+// Called by the library once per FIFO frame during IMU.readFifo()
+static void imu_fifo_frame(inv_imu_sensor_event_t *event)
+{
+    const int both = (1 << INV_SENSOR_ACCEL) | (1 << INV_SENSOR_GYRO);
+    if ((event->sensor_mask & both) != both || sample_count >= IMU_FIFO_MAX)
+        return;
+
+    // FIFO frames are contiguous and at most 625us apart, so the 1us FIFO
+    // timestamp never wraps twice between them and the 16 bit difference
+    // extends it to a 32 bit micros() scale however long the drains are apart.
+    // Resyncing on the first frame of a burst, it was queued one period per
+    // following frame before the drain.
+    if (fifo_synced)
+        fifo_ts_us += (uint16_t)(event->timestamp_fsync - fifo_last_tmst);
+    else
+        fifo_ts_us = fifo_drain_us - (uint32_t)(fifo_frames - 1) * (1000000 / odr_hz);
+    fifo_synced = true;
+    fifo_last_tmst = event->timestamp_fsync;
+
+    ImuSample_t *smp = &samples[sample_count++];
+    smp->ts_us = fifo_ts_us;
+    memcpy(smp->accel, event->accel, sizeof(smp->accel));
+    memcpy(smp->gyro, event->gyro, sizeof(smp->gyro));
+    for (int i = 0; i < 3; i++)
+        smp->lsb[i] = hires ? (uint8_t)((event->accel_high_res[i] << 4) | (event->gyro_high_res[i] & 0x0F)) : 0;
+    smp->temp = hires ? imu_temp(event->temperature) : (int8_t)event->temperature; // 16 byte frames carry 0.5C already
+}
+
+// Counts on the 16 bit scale, the hires low nibble adds a fraction
+static inline float imu_counts(int16_t hi, uint8_t lo4)
+{
+    return (float)hi + (float)lo4 * (1.0f / 16.0f);
+}
 
 bool imu_init()
 {
+#ifdef IMU_SPI
+    SPI1.setMISO(PIN_IMU_MISO);
+#endif
+
+    // The sensor is only programmed here, so the read path runs on these
+    // rather than the live config a SET can change under it
+    fifo_mode = config.imu_fifo_wm > 0;
+    irq_mode = config.imu_irq_en;
+    hires = fifo_mode && config.imu_fifo_hires_en; // the 20 bit scales only ever see FIFO samples
+
+    // Oversampling only through the FIFO, the loop can't poll registers that fast
+    odr_hz = ODR_HZ;
+    if (fifo_mode && (config.imu_odr_hz == 3200 || config.imu_odr_hz == 6400))
+        odr_hz = (uint16_t)config.imu_odr_hz;
+    integrate = fifo_mode;
+    imu_cal_update();
+
     int ret = IMU.begin();
     if (ret != 0)
         return false;
 
-    ret = IMU.startAccel(ODR_HZ, ACCEL_FSR_G);
+    ret = IMU.startAccel(odr_hz, ACCEL_FSR_G);
     if (ret != 0)
         return false;
 
-    ret = IMU.startGyro(ODR_HZ, GYRO_FSR_DPS);
+    ret = IMU.startGyro(odr_hz, GYRO_FSR_DPS);
     if (ret != 0)
         return false;
 
+    if (fifo_mode)
+    {
+        uint8_t wm = (uint8_t)(config.imu_fifo_wm < FIFO_WM_MAX ? config.imu_fifo_wm : FIFO_WM_MAX);
+        ret = IMU.enableFifoInterrupt(PIN_IMU_INT1, imu_isr, wm, hires);
+        if (ret != 0)
+            return false;
+    }
+    else if (irq_mode)
+    {
+#ifdef IMU_SPI
+        dma_done.attachImmediate(imu_dma_complete);
+        SPI1.usingInterrupt(PIN_IMU_INT1); // the ISR starts SPI1 transactions, keep it off every other SPI1 user
+#endif
+        ret = IMU.enableDataReadyInterrupt(PIN_IMU_INT1, imu_isr);
+        if (ret != 0)
+            return false;
+    }
+
     return true;
 }
 
-void imu_cal_gyro(FltData_t *fltdata)
+// Register mode. Polled it may repeat or skip sensor samples, on the data
+// ready interrupt it reads each sample once, stamped with the interrupt time,
+// and SPI builds only pick up the sample the DMA already read
+static uint16_t imu_read_regs()
 {
-    const int smps = 500;
+    inv_imu_sensor_data_t imu_data;
+    uint32_t ts_us = micros();
 
-    float s_x = 0;
-    float s_y = 0;
-    float s_z = 0;
+    if (irq_mode && !imu_take_irq(&ts_us))
+        return 0;
 
-    inv_imu_sensor_data_t imu_data;
+    if (imu_async())
+        return imu_latest(&samples[0]) ? 1 : 0;
+
+    int ret = IMU.getDataFromRegisters(imu_data);
+    if (ret != 0)
+        return 0;
+
+    samples[0].ts_us = ts_us;
+    memcpy(samples[0].accel, imu_data.accel_data, sizeof(samples[0].accel));
+    memcpy(samples[0].gyro, imu_data.gyro_data, sizeof(samples[0].gyro));
+    memset(samples[0].lsb, 0, sizeof(samples[0].lsb));
+    samples[0].temp = imu_temp(imu_data.temp_data);
+
+    return 1;
+}
+
+// FIFO mode, drains every frame queued since the last watermark in one burst
+static uint16_t imu_read_fifo()
+{
+    uint32_t irq_ts;
+    if (!imu_take_irq(&irq_ts)) // frames landing during the drain raise it again
+        return 0;
 
-    for (int i = 0; i < smps; i++)
+    fifo_drain_us = micros();
+
+    sample_count = 0;
+    bool overflow;
+    if (IMU.readFifo(imu_fifo_frame, fifo_frames, overflow) != 0)
+    {
+        fifo_synced = false;
+        return 0;
+    }
+
+    // Frames were dropped after this burst, the next one starts after a gap
+    // the 16 bit timestamp can't measure
+    if (overflow)
+        fifo_synced = false;
+    else if (sample_count > 0)
     {
-        IMU.getDataFromRegisters(imu_data);
-        s_x += (float)imu_data.gyro_data[0] * GYRO_SCALE;
-        s_y += (float)imu_data.gyro_data[1] * GYRO_SCALE;
-        s_z += (float)imu_data.gyro_data[2] * GYRO_SCALE;
-        delay(1);
+        // The sensor oscillator drifts against micros(). Slew the next stamp a
+        // sixteenth of the way to the drain time, the last frame was queued at
+        // most a period before it, and never by more than a quarter period so
+        // the stamps keep increasing.
+        int32_t lim = (int32_t)(1000000 / odr_hz) / 4;
+        int32_t corr = (int32_t)(fifo_drain_us - fifo_ts_us) / 16;
+        fifo_ts_us += (uint32_t)(corr < -lim ? -lim : corr > lim ? lim : corr);
     }
 
-    float sign_flip = config.test_mode_en ? -1.0f : 1.0f;
+    return sample_count;
+}
 
-    if (sign_flip != 1.0f)
-        Serial1.println("MSG: INVERTED TEST MODE ENABLED");
+// out = flip * cal * gain(T) * (count_scale * counts - bias(T)) + flip * cal_offset
+static void imu_xf_build(float xf[3][4], const float cal[3][4], const float tc[3][5], float count_scale, float dtemp)
+{
+    float gain[3], bias[3];
+    for (int j = 0; j < 3; j++)
+    {
+        gain[j] = 1.0f + (tc[j][3] + tc[j][4] * dtemp) * dtemp;
+        bias[j] = tc[j][0] + (tc[j][1] + tc[j][2] * dtemp) * dtemp;
+    }
 
-    fltdata->gyro_bias[0] = (s_x / smps) * sign_flip;
-    fltdata->gyro_bias[1] = s_y / smps;
-    fltdata->gyro_bias[2] = (s_z / smps) * sign_flip;
+    for (int i = 0; i < 3; i++)
+    {
+        // Test mode flips body x and z
+        float flip = (config.test_mode_en && i != 1) ? -1.0f : 1.0f;
+        xf[i][3] = cal[i][3];
+        for (int j = 0; j < 3; j++)
+        {
+            float m = cal[i][j] * gain[j];
+            xf[i][j] = flip * m * count_scale;
+            xf[i][3] -= m * bias[j];
+        }
+        xf[i][3] *= flip;
+    }
 }
 
-bool imu_read(FltData_t *fltdata)
+void imu_cal_update()
 {
-    inv_imu_sensor_data_t imu_data;
+    xf_temp = INT16_MIN;
+}
 
-    int ret = IMU.getDataFromRegisters(imu_data);
-    if (ret != 0)
-        return false;
+// One sample in body axis m/s^2 and rad/s with the calibration applied, gyro
+// bias subtracted
+static void imu_scale(const ImuSample_t *smp, const float gyro_bias[3], float accel[3], float gyro[3])
+{
+    if (smp->temp != xf_temp)
+    {
+        float dtemp = smp->temp * 0.5f;
+        imu_xf_build(accel_xf, config.imu_cal_accel, config.imu_tc_accel, hires ? ACCEL_HIRES_SCALE : ACCEL_SCALE, dtemp);
+        imu_xf_build(gyro_xf, config.imu_cal_gyro, config.imu_tc_gyro, hires ? GYRO_HIRES_SCALE : GYRO_SCALE, dtemp);
+        xf_temp = smp->temp;
+    }
+
+    float a[3], g[3];
+    for (int j = 0; j < 3; j++)
+    {
+        a[j] = imu_counts(smp->accel[j], smp->lsb[j] >> 4);
+        g[j] = imu_counts(smp->gyro[j], smp->lsb[j] & 0x0F);
+    }
 
-    fltdata->accel[0] = ((float)imu_data.accel_data[0] * ACCEL_SCALE);
-    fltdata->accel[1] = ((float)imu_data.accel_data[1] * ACCEL_SCALE);
-    fltdata->accel[2] = ((float)imu_data.accel_data[2] * ACCEL_SCALE);
+    for (int i = 0; i < 3; i++)
+    {
+        accel[i] = accel_xf[i][0] * a[0] + accel_xf[i][1] * a[1] + accel_xf[i][2] * a[2] + accel_xf[i][3];
+        gyro[i] = gyro_xf[i][0] * g[0] + gyro_xf[i][1] * g[1] + gyro_xf[i][2] * g[2] + gyro_xf[i][3] - gyro_bias[i];
+    }
+}
 
-    fltdata->gyro[0] = ((float)imu_data.gyro_data[0] * GYRO_SCALE);
-    fltdata->gyro[1] = ((float)imu_data.gyro_data[1] * GYRO_SCALE);
-    fltdata->gyro[2] = ((float)imu_data.gyro_data[2] * GYRO_SCALE);
+static inline void cross(const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
 
-    if (config.test_mode_en)
+// FIFO mode. Every sample of the tick goes into one delta angle with the
+// recursive coning correction plus the two sample term against the previous
+// sample, and one delta velocity with the matching sculling terms and the
+// rotation correction (Savage), each sample over its own timestamp interval.
+// Vibration driven coning and sculling at the sample rate then survives
+// down to the control rate. accel and gyro become the tick averages.
+static void imu_integrate(FltData_t *fltdata)
+{
+    const float period_s = 1.0f / odr_hz;
+    float alpha[3] = {0.0f, 0.0f, 0.0f}; // summed delta angle
+    float beta[3] = {0.0f, 0.0f, 0.0f};  // coning
+    float dv[3] = {0.0f, 0.0f, 0.0f};    // summed delta velocity
+    float scul[3] = {0.0f, 0.0f, 0.0f};  // sculling
+    float t = 0.0f;
+
+    for (uint16_t n = 0; n < sample_count; n++)
     {
-        fltdata->accel[0] = -fltdata->accel[0];
-        fltdata->accel[2] = -fltdata->accel[2];
-        fltdata->gyro[0] = -fltdata->gyro[0];
-        fltdata->gyro[2] = -fltdata->gyro[2];
+        const ImuSample_t *smp = &samples[n];
+        float a[3], w[3], da[3], dvk[3], c_ad[3], c_av[3], c_vd[3], c_pd[3], c_pa[3], c_pv[3];
+
+        imu_scale(smp, fltdata->gyro_bias, a, w);
+
+        // First sample ever, or the timestamp was resynced
+        float dt = (smp->ts_us - last_smp_us) * 1e-6f;
+        if (dt <= 0.0f || dt > 4.0f * period_s)
+        {
+            dt = period_s;
+            memset(last_da, 0, sizeof(last_da)); // no usable previous sample
+            memset(last_dv, 0, sizeof(last_dv));
+        }
+        last_smp_us = smp->ts_us;
+
+        for (int i = 0; i < 3; i++)
+        {
+            da[i] = w[i] * dt;
+            dvk[i] = a[i] * dt;
+        }
+
+        cross(alpha, da, c_ad);
+        cross(alpha, dvk, c_av);
+        cross(dv, da, c_vd);
+        cross(last_da, da, c_pd);
+        cross(last_da, dvk, c_pa);
+        cross(last_dv, da, c_pv);
+
+        for (int i = 0; i < 3; i++)
+        {
+            beta[i] += 0.5f * c_ad[i] + (1.0f / 12.0f) * c_pd[i];
+            scul[i] += 0.5f * (c_av[i] + c_vd[i]) + (1.0f / 12.0f) * (c_pa[i] + c_pv[i]);
+            alpha[i] += da[i];
+            dv[i] += dvk[i];
+            last_da[i] = da[i];
+            last_dv[i] = dvk[i];
+        }
+        t += dt;
     }
 
-    fltdata->gyro[0] -= fltdata->gyro_bias[0];
-    fltdata->gyro[1] -= fltdata->gyro_bias[1];
-    fltdata->gyro[2] -= fltdata->gyro_bias[2];
+    float rot[3];
+    cross(alpha, dv, rot);
 
-    return true;
+    for (int i = 0; i < 3; i++)
+    {
+        fltdata->dtheta[i] = alpha[i] + beta[i];
+        fltdata->gyro[i] = fltdata->dtheta[i] / t;
+        fltdata->accel[i] = (dv[i] + 0.5f * rot[i] + scul[i]) / t;
+    }
+}
+
+uint16_t imu_read(FltData_t *fltdata)
+{
+    sample_count = fifo_mode ? imu_read_fifo() : imu_read_regs();
+    if (sample_count == 0)
+        return 0;
+
+    fltdata->imu_raw = samples[sample_count - 1];
+
+    if (integrate)
+        imu_integrate(fltdata);
+    else
+        imu_scale(&fltdata->imu_raw, fltdata->gyro_bias, fltdata->accel, fltdata->gyro); // newest sample only
+
+    return sample_count;
+}
+
+void imu_bias_update(FltData_t *fltdata)
+{
+    static const float zero_bias[3] = {0.0f, 0.0f, 0.0f};
+    const uint32_t window = odr_hz * BIAS_WINDOW_MS / 1000;
+
+    for (uint16_t n = 0; n < sample_count; n++)
+    {
+        float v[6];
+        imu_scale(&samples[n], zero_bias, &v[0], &v[3]);
+
+        for (int i = 0; i < 6; i++)
+        {
+            if (bias_n == 0)
+            {
+                bias_ref[i] = v[i];
+                bias_sum[i] = 0.0f;
+                bias_sq[i] = 0.0f;
+            }
+            float d = v[i] - bias_ref[i];
+            bias_sum[i] += d;
+            bias_sq[i] += d * d;
+        }
+
+        if (++bias_n < window)
+            continue;
+
+        // Still when every axis stays inside the noise thresholds, a bump or
+        // handling anywhere in the window throws the whole window away
+        float accel_var_max = config.imu_still_accel_ms2 * config.imu_still_accel_ms2;
+        float gyro_var_max = config.imu_still_gyro_dps * DEG_2_RAD * config.imu_still_gyro_dps * DEG_2_RAD;
+        bool still = true;
+        float mean[6];
+
+        for (int i = 0; i < 6; i++)
+        {
+            float m = bias_sum[i] / bias_n;
+            float var = bias_sq[i] / bias_n - m * m;
+            still = still && var <= (i < 3 ? accel_var_max : gyro_var_max);
+            mean[i] = bias_ref[i] + m;
+        }
+        bias_n = 0;
+
+        if (!still)
+            continue;
+
+        if (bias_windows < BIAS_WINDOWS_MAX)
+            bias_windows++;
+
+        // Written once per window, so the log only gets a bias record at 2Hz
+        for (int i = 0; i < 3; i++)
+            fltdata->gyro_bias[i] += (mean[3 + i] - fltdata->gyro_bias[i]) / bias_windows;
+    }
+}
+
+uint32_t imu_bias_windows()
+{
+    return bias_windows;
+}
+
+const ImuSample_t *imu_samples()
+{
+    return samples;
+}
+
+uint32_t imu_period_us()
+{
+    return 1000000 / odr_hz;
+}
+
+void imu_bench_bus()
+{
+    const int reps = 100;
+    inv_imu_sensor_data_t imu_data;
+    uint32_t cyc_total = 0, cyc_max = 0;
+    int errors = 0;
+
+    imu_bus_hold(true);
+    for (int r = 0; r < reps; r++)
+    {
+        uint32_t t0 = ARM_DWT_CYCCNT;
+        if (IMU.getDataFromRegisters(imu_data) != 0)
+            errors++;
+        uint32_t cyc = ARM_DWT_CYCCNT - t0;
+
+        cyc_total += cyc;
+        if (cyc > cyc_max)
+            cyc_max = cyc;
+    }
+    imu_bus_hold(false);
+
+    uint32_t cyc_per_us = F_CPU_ACTUAL / 1000000;
+    Serial1.printf("STAT: BENCH_IMU_BUS %s %lu KHZ, SAMPLE READ %lu NS AVG, %lu NS MAX, ERRORS %d/%d\n",
+                   IMU_BUS_NAME, (uint32_t)IMU_BUS_HZ / 1000, (uint32_t)((uint64_t)cyc_total * 1000 / reps / cyc_per_us),
+                   (uint32_t)((uint64_t)cyc_max * 1000 / cyc_per_us), errors, reps);
+}
+
+bool imu_ready()
+{
+    return irq_pending;
+}
+
+bool imu_irq_mode()
+{
+    return irq_mode;
+}
+
+bool imu_read_start()
+{
+#ifdef IMU_SPI
+    noInterrupts();
+    bool idle = !dma_busy && !dma_hold;
+    if (idle)
+        dma_busy = true; // claimed before the data ready interrupt can start one
+    interrupts();
+
+    if (!idle)
+        return false;
+    return imu_dma_start(micros());
+#else
+    return false;
+#endif
+}
+
+void imu_set_read_cb(ImuSampleCb_t cb)
+{
+#ifdef IMU_SPI
+    read_cb = cb;
+#endif
+}
+
+bool imu_latest(ImuSample_t *smp)
+{
+#ifdef IMU_SPI
+    noInterrupts();
+    bool is_new = latest_new;
+    *smp = latest;
+    latest_new = false;
+    interrupts();
+    return is_new;
+#else
+    return false;
+#endif
 }
 
 void imu_calc_initial_att(FltData_t *fltdata)
@@ -131,19 +646,41 @@ void imu_calc_initial_att(FltData_t *fltdata)
 void imu_calc_att(FltData_t *fltdata, float dt)
 {
     float q0 = fltdata->quat[0], q1 = fltdata->quat[1], q2 = fltdata->quat[2], q3 = fltdata->quat[3];
-    float gx = fltdata->gyro[0], gy = fltdata->gyro[1], gz = fltdata->gyro[2];
-
-    // Rate of change of quaternion from Gyro
-    float qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
-    float qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
-    float qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
-    float qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
-
-    // Integrate
-    q0 += qDot1 * dt;
-    q1 += qDot2 * dt;
-    q2 += qDot3 * dt;
-    q3 += qDot4 * dt;
+
+    if (integrate)
+    {
+        // Rotate by the tick's delta angle exactly, dt is already in it
+        const float *phi = fltdata->dtheta;
+        float angle = sqrtf(phi[0] * phi[0] + phi[1] * phi[1] + phi[2] * phi[2]);
+        float r0 = cosf(0.5f * angle);
+        float s = angle > 1e-6f ? sinf(0.5f * angle) / angle : 0.5f;
+        float r1 = phi[0] * s, r2 = phi[1] * s, r3 = phi[2] * s;
+
+        float w = q0 * r0 - q1 * r1 - q2 * r2 - q3 * r3;
+        float x = q0 * r1 + q1 * r0 + q2 * r3 - q3 * r2;
+        float y = q0 * r2 - q1 * r3 + q2 * r0 + q3 * r1;
+        float z = q0 * r3 + q1 * r2 - q2 * r1 + q3 * r0;
+        q0 = w;
+        q1 = x;
+        q2 = y;
+        q3 = z;
+    }
+    else
+    {
+        float gx = fltdata->gyro[0], gy = fltdata->gyro[1], gz = fltdata->gyro[2];
+
+        // Rate of change of quaternion from Gyro
+        float qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+        float qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+        float qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+        float qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+        // Integrate
+        q0 += qDot1 * dt;
+        q1 += qDot2 * dt;
+        q2 += qDot3 * dt;
+        q3 += qDot4 * dt;
+    }
 
     // Normalize
     float recipNorm = 1.0f / sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
@@ -1,14 +1,242 @@
 #include "log.h"
 #include "eeprom_config.h"
+#include "imu.h"
 #include <SdFat.h>
+#include <stdarg.h>
 
 static SdFs sd;
 static FsFile logfile;
+static char logfile_name[32]; // name of the log being written, never handed out for download
 
 static bool sd_ready = false;
 static bool logfile_open = false;
 
-int serializer(char *buf, size_t buf_size, uint32_t timestamp, FltStates_t state, const FltData_t *data)
+// Preallocated mode: blocks go straight to consecutive sectors of the
+// file's contiguous extent, the FAT and directory are only touched at close
+static bool raw_mode = false;
+static uint32_t raw_first_sector = 0; // sector of block seq 0
+static uint32_t raw_last_sector = 0;  // last sector of the extent
+static uint64_t file_end = 0;         // end of the highest block on the card, the size at close
+static bool prealloc = false;         // the extent was reserved at open, close truncates it back
+
+#define LOG_WRITE_RETRIES 3 // log_service() attempts at a block before dropping it
+
+// Ring of sector sized blocks. loop() fills the head block, log_service()
+// drains completed blocks from the tail as whole 512 byte sector writes.
+DMAMEM static uint8_t ring[LOG_RING_BLOCKS][LOG_BLOCK_SIZE] __attribute__((aligned(32)));
+static uint16_t ring_head = 0;                      // block currently being filled
+static uint16_t ring_tail = 0;                      // oldest sealed block not yet on the card
+static uint16_t fill_pos = sizeof(LogBlockHdr_t);   // bytes used in the head block
+static uint32_t block_seq = 0;                      // sequence number of the head block
+static uint32_t file_id = 0;                        // LogBlockHdr_t file_id of the open file
+static uint32_t head_open_time = 0;                 // millis() of the first record in the head block
+
+static uint32_t crc_table[256];
+
+// Pre-trigger window, overwritten continuously until liftoff freezes it
+#ifdef LOG_PRETRIG_PSRAM
+EXTMEM static ImuSample_t pretrig[LOG_PRETRIG_SAMPLES];
+#else
+DMAMEM static ImuSample_t pretrig[LOG_PRETRIG_SAMPLES];
+#endif
+static uint32_t pretrig_head = 0;    // next slot to overwrite
+static uint32_t pretrig_count = 0;   // valid samples in the window
+static bool pretrig_frozen = false;  // set at liftoff, window no longer updated
+static uint32_t pretrig_pending = 0; // frozen samples not yet queued to the ring
+
+static const int PRETRIG_BURST = 56; // samples queued per log_service() call, ~2 blocks
+
+// Delta compression reference, quantized fields of the last frame written
+static int32_t delta_ref[LOG_FRAME_FIELDS];
+static uint32_t delta_ref_ts = 0;
+static uint8_t delta_ref_state = 0;
+static uint16_t delta_count = 0;      // delta frames since the last keyframe
+static bool delta_need_key = true;    // next frame must be a keyframe
+
+// Seek index, written as the log footer
+DMAMEM static LogIndexEntry_t index_tab[LOG_INDEX_MAX];
+static uint32_t index_count = 0;
+static uint32_t index_last_time = 0;
+static uint8_t index_last_state = 0xFF; // forces an entry on the first frame
+static uint32_t index_interval_ms = LOG_INDEX_INTERVAL_MS;
+
+// Slow changing values carried over by readers, see LogFrame_t
+static LogBaro_t baro_last = {};
+static float bias_last[3];
+static bool bias_logged = false; // bias_last is in the log
+
+// Event journal. Events are stamped when they happen and wait here until the
+// ring has room, so raising one never blocks and a momentarily full ring
+// or a log file that is not open yet does not lose it
+#define LOG_JOURNAL_SIZE 16
+
+typedef struct
+{
+    LogEvent_t evt;
+    uint8_t len;
+    char text[LOG_EVENT_TEXT_MAX];
+} JournalEntry_t;
+
+static JournalEntry_t journal[LOG_JOURNAL_SIZE];
+static uint8_t journal_tail = 0;  // oldest pending event
+static uint8_t journal_count = 0; // pending events
+
+// Log download over the serial link, separate read only handles so the
+// logger's own file is never disturbed
+static FsFile ls_dir;
+static FsFile dl_file;
+
+// Whole flight capture in PSRAM. Between log_capture_start() and
+// log_capture_flush() sealed blocks are copied here instead of written, so
+// the card is not touched in flight, then go to the card in large bursts
+#define CAPTURE_BURST 64 // blocks per card write while flushing, 32KB
+
+typedef enum
+{
+    CAP_OFF,
+    CAP_RECORD,
+    CAP_FLUSH
+} CaptureState_t;
+
+static uint8_t *capture = nullptr;  // extmem_malloc()ed at boot, nullptr without PSRAM
+static uint32_t capture_blocks = 0; // capacity
+static uint32_t capture_head = 0;   // next free block
+static uint32_t capture_tail = 0;   // next block to write to the card
+static CaptureState_t capture_state = CAP_OFF;
+static uint32_t capture_flush_start = 0;
+static uint32_t capture_flushed = 0; // blocks written by the current flush
+
+static LogStats_t stats;
+static LogLatency_t latency;
+
+// Longest serializer() output: every float falling back to snprintf at
+// FLT_MAX (44 chars) plus the keys, rounded up
+#define SERIALIZER_MAX 1280
+
+static const uint32_t POW10[] = {1, 10, 100, 1000};
+
+static char *put_uint(char *p, uint32_t v)
+{
+    char tmp[10];
+    int n = 0;
+
+    do
+    {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+
+    while (n)
+        *p++ = tmp[--n];
+    return p;
+}
+
+// Same text as printf("%.*f", decimals, v) for decimals 0..3, without the
+// printf machinery. The float is exactly mant * 2^exp, so v * 10^decimals is
+// computed in 64 bit integers and rounded half to even like newlib does.
+// NaN, inf and values above 2^53 go through snprintf.
+static char *put_fixed(char *p, float v, int decimals)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+
+    int biased = (int)((bits >> 23) & 0xFF);
+    uint64_t mant = bits & 0x7FFFFF;
+    int exp;
+
+    if (biased == 0)
+        exp = -149; // subnormal
+    else
+    {
+        mant |= 0x800000;
+        exp = biased - 150;
+    }
+
+    if (biased == 0xFF || exp > 29)
+        return p + snprintf(p, 48, "%.*f", decimals, (double)v);
+
+    uint64_t n;
+    if (exp >= 0)
+        n = (mant << exp) * POW10[decimals];
+    else if (exp <= -64)
+        n = 0; // below 2^-40, rounds to zero at any supported precision
+    else
+    {
+        uint64_t prod = mant * POW10[decimals];
+        int shift = -exp;
+        uint64_t rem = prod & ((1ULL << shift) - 1);
+        uint64_t half = 1ULL << (shift - 1);
+
+        n = prod >> shift;
+        if (rem > half || (rem == half && (n & 1)))
+            n++;
+    }
+
+    // printf keeps the sign of negative values that round to zero
+    if (bits >> 31)
+        *p++ = '-';
+
+    uint32_t frac;
+    if (n <= 0xFFFFFFFF)
+    {
+        p = put_uint(p, (uint32_t)n / POW10[decimals]);
+        frac = (uint32_t)n % POW10[decimals];
+    }
+    else
+    {
+        // At most 2^53 * 1000, the integer part is split to stay in 32 bits
+        uint64_t ip = n / POW10[decimals];
+        frac = (uint32_t)(n % POW10[decimals]);
+        if (ip >= 1000000000)
+        {
+            p = put_uint(p, (uint32_t)(ip / 1000000000));
+            uint32_t lo = (uint32_t)(ip % 1000000000);
+            for (int i = 8; i >= 0; i--)
+            {
+                p[i] = (char)('0' + lo % 10);
+                lo /= 10;
+            }
+            p += 9;
+        }
+        else
+            p = put_uint(p, (uint32_t)ip);
+    }
+
+    if (decimals > 0)
+    {
+        *p++ = '.';
+        for (int i = decimals - 1; i >= 0; i--)
+        {
+            p[i] = (char)('0' + frac % 10);
+            frac /= 10;
+        }
+        p += decimals;
+    }
+    return p;
+}
+
+static char *put_str(char *p, const char *s)
+{
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+static char *put_array(char *p, const float *v, int count, int decimals)
+{
+    *p++ = '[';
+    for (int i = 0; i < count; i++)
+    {
+        if (i)
+            *p++ = ',';
+        p = put_fixed(p, v[i], decimals);
+    }
+    *p++ = ']';
+    return p;
+}
+
+// Reference implementation, kept for log_bench_serializer()
+static int serializer_printf(char *buf, size_t buf_size, uint32_t timestamp, FltStates_t state, const FltData_t *data)
 {
     return snprintf(buf, buf_size,
                     "{\"timestamp\":%lu,\"state\":%d,"
@@ -27,6 +255,330 @@ int serializer(char *buf, size_t buf_size, uint32_t timestamp, FltStates_t state
                     data->gyro_bias[0], data->gyro_bias[1], data->gyro_bias[2]);
 }
 
+// Same output and return value as the snprintf version above
+int serializer(char *buf, size_t buf_size, uint32_t timestamp, FltStates_t state, const FltData_t *data)
+{
+    char out[SERIALIZER_MAX];
+    char *p = out;
+
+    p = put_str(p, "{\"timestamp\":");
+    p = put_uint(p, timestamp);
+    p = put_str(p, ",\"state\":");
+    if ((int)state < 0)
+    {
+        *p++ = '-';
+        p = put_uint(p, -(uint32_t)(int)state);
+    }
+    else
+        p = put_uint(p, (uint32_t)state);
+    p = put_str(p, ",\"raw_accel\":");
+    p = put_array(p, data->accel, 3, 3);
+    p = put_str(p, ",\"raw_gyro\":");
+    p = put_array(p, data->gyro, 3, 3);
+    p = put_str(p, ",\"pressure\":");
+    p = put_fixed(p, data->pressure, 3);
+    p = put_str(p, ",\"altitude\":");
+    p = put_fixed(p, data->altitude, 3);
+    p = put_str(p, ",\"quats\":");
+    p = put_array(p, data->quat, 4, 3);
+    p = put_str(p, ",\"servo\":");
+    p = put_array(p, data->servo_out, 4, 1);
+    p = put_str(p, ",\"gyro_bias\":");
+    p = put_array(p, data->gyro_bias, 3, 3);
+    *p++ = '}';
+
+    int len = (int)(p - out);
+
+    // snprintf semantics: truncate to fit, always terminate, return full length
+    if (buf_size > 0)
+    {
+        size_t n = (size_t)len < buf_size ? (size_t)len : buf_size - 1;
+        memcpy(buf, out, n);
+        buf[n] = '\0';
+    }
+    return len;
+}
+
+// Times serializer() against the snprintf version on a fixed set of awkward
+// values (ties, negative zero, subnormals, NaN, huge) and checks the output
+// is byte identical
+void log_bench_serializer()
+{
+    static const float vals[] = {0.0f, -0.0f, 0.0625f, -0.0625f, 0.25f, 90.75f, -0.0004f, 9.80665f,
+                                 1013.25f, 1e-40f, 123456.789f, -3e38f, NAN, -INFINITY, 0.9999996f, 1e12f};
+    const int nvals = sizeof(vals) / sizeof(vals[0]);
+    const int reps = 50;
+    char a[SERIALIZER_MAX], b[SERIALIZER_MAX];
+    FltData_t d = {};
+    uint32_t cyc_printf = 0, cyc_fast = 0;
+    int mismatches = 0;
+
+    for (int r = 0; r < reps; r++)
+    {
+        float *f[] = {&d.accel[0], &d.accel[1], &d.accel[2], &d.gyro[0], &d.gyro[1], &d.gyro[2],
+                      &d.pressure, &d.altitude, &d.quat[0], &d.quat[1], &d.quat[2], &d.quat[3],
+                      &d.servo_out[0], &d.servo_out[1], &d.servo_out[2], &d.servo_out[3],
+                      &d.gyro_bias[0], &d.gyro_bias[1], &d.gyro_bias[2]};
+        for (size_t i = 0; i < sizeof(f) / sizeof(f[0]); i++)
+            *f[i] = vals[(r + i) % nvals];
+
+        uint32_t t0 = ARM_DWT_CYCCNT;
+        int la = serializer_printf(a, sizeof(a), 123456 + r, STATE_PREFLT, &d);
+        uint32_t t1 = ARM_DWT_CYCCNT;
+        int lb = serializer(b, sizeof(b), 123456 + r, STATE_PREFLT, &d);
+        uint32_t t2 = ARM_DWT_CYCCNT;
+
+        cyc_printf += t1 - t0;
+        cyc_fast += t2 - t1;
+        if (la != lb || memcmp(a, b, la) != 0)
+            mismatches++;
+    }
+
+    Serial1.printf("STAT: BENCH_SERIALIZER SNPRINTF %lu CYC, FAST %lu CYC, MISMATCHES %d/%d\n",
+                   cyc_printf / reps, cyc_fast / reps, mismatches, reps);
+}
+
+size_t log_encode_frame(uint8_t *buf, uint32_t timestamp, FltStates_t state, const FltData_t *data)
+{
+    LogRecHdr_t hdr = {.type = LOG_REC_FRAME, .len = sizeof(LogFrame_t)};
+    LogFrame_t frame;
+
+    frame.timestamp = timestamp;
+    frame.state = (uint8_t)state;
+    memcpy(frame.accel, data->accel, sizeof(frame.accel));
+    memcpy(frame.gyro, data->gyro, sizeof(frame.gyro));
+    memcpy(frame.quat, data->quat, sizeof(frame.quat));
+    memcpy(frame.servo_out, data->servo_out, sizeof(frame.servo_out));
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), &frame, sizeof(frame));
+
+    return sizeof(hdr) + sizeof(frame);
+}
+
+// JSON resolution of each delta field, see serializer()
+static const float DELTA_SCALE[LOG_FRAME_FIELDS] = {
+    1000.0f, 1000.0f, 1000.0f,          // accel
+    1000.0f, 1000.0f, 1000.0f,          // gyro
+    1000.0f, 1000.0f, 1000.0f, 1000.0f, // quat
+    10.0f, 10.0f, 10.0f, 10.0f};        // servo_out
+
+// False if a field is NaN, inf or too large for the deltas, the frame then
+// goes out as a keyframe and restarts the chain
+static bool log_quantize(const FltData_t *data, int32_t *q)
+{
+    float v[LOG_FRAME_FIELDS];
+
+    memcpy(&v[0], data->accel, sizeof(data->accel));
+    memcpy(&v[3], data->gyro, sizeof(data->gyro));
+    memcpy(&v[6], data->quat, sizeof(data->quat));
+    memcpy(&v[10], data->servo_out, sizeof(data->servo_out));
+
+    // The double product is exact and lrint() rounds half to even, so q
+    // matches the digits %.3f / %.1f would print for the same float. Negative
+    // values move down by one so the "-0.000" of one that rounds to zero
+    // survives, printf keeps that sign too.
+    bool ok = true;
+    for (int i = 0; i < LOG_FRAME_FIELDS; i++)
+    {
+        double x = (double)v[i] * DELTA_SCALE[i];
+        if (!(fabs(x) < LOG_DELTA_LIMIT))
+        {
+            q[i] = 0;
+            ok = false;
+            continue;
+        }
+        q[i] = (int32_t)lrint(x) - (signbit(v[i]) ? 1 : 0);
+    }
+    return ok;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static size_t log_encode_delta(uint8_t *buf, uint32_t timestamp, const int32_t *q)
+{
+    uint8_t *p = buf + sizeof(LogRecHdr_t);
+    uint32_t mask = 0;
+
+    p = put_varint(p, timestamp - delta_ref_ts);
+
+    uint8_t *mask_p = p;
+    p += 2;
+
+    for (int i = 0; i < LOG_FRAME_FIELDS; i++)
+    {
+        int32_t d = q[i] - delta_ref[i];
+        if (d != 0)
+        {
+            mask |= 1UL << i;
+            p = put_varint(p, zigzag(d));
+        }
+    }
+
+    mask_p[0] = (uint8_t)mask;
+    mask_p[1] = (uint8_t)(mask >> 8);
+
+    LogRecHdr_t hdr = {.type = LOG_REC_DELTA, .len = (uint8_t)(p - buf - sizeof(LogRecHdr_t))};
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    return p - buf;
+}
+
+static uint16_t ring_used()
+{
+    return (ring_head + LOG_RING_BLOCKS - ring_tail) % LOG_RING_BLOCKS;
+}
+
+static void crc32_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (0xEDB88320UL ^ (c >> 1)) : (c >> 1);
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Closes the head block and hands it to the writer. The CRC is left to
+// log_write_block() so it is computed outside the control path
+static void log_seal_block()
+{
+    LogBlockHdr_t hdr = {
+        .magic = LOG_BLOCK_MAGIC,
+        .seq = block_seq++,
+        .file_id = file_id,
+        .len = (uint16_t)(fill_pos - sizeof(LogBlockHdr_t)),
+        .version = LOG_VERSION,
+        .crc = 0};
+
+    memcpy(ring[ring_head], &hdr, sizeof(hdr));
+    memset(&ring[ring_head][fill_pos], 0, LOG_BLOCK_SIZE - fill_pos);
+
+    ring_head = (ring_head + 1) % LOG_RING_BLOCKS;
+    fill_pos = sizeof(LogBlockHdr_t);
+}
+
+// Copies a whole record into the head block, records are never split
+static bool log_put(const uint8_t *data, size_t len)
+{
+    if (fill_pos + len > LOG_BLOCK_SIZE)
+    {
+        if (ring_used() >= LOG_RING_BLOCKS - 1)
+        {
+            stats.overflows++;
+            return false;
+        }
+
+        log_seal_block();
+    }
+
+    if (fill_pos == sizeof(LogBlockHdr_t))
+        head_open_time = millis();
+
+    memcpy(&ring[ring_head][fill_pos], data, len);
+    fill_pos += len;
+
+    uint16_t used = ring_used();
+    if (used > stats.max_used_blocks)
+        stats.max_used_blocks = used;
+
+    return true;
+}
+
+// Wraps a payload of up to 255 bytes in a record header and queues it
+static bool log_put_rec(uint8_t type, const void *payload, size_t len)
+{
+    uint8_t buf[sizeof(LogRecHdr_t) + 255];
+    LogRecHdr_t hdr = {.type = type, .len = (uint8_t)len};
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), payload, len);
+
+    return log_put(buf, sizeof(hdr) + len);
+}
+
+// Moves journaled events into the ring, oldest first, until it is full
+static void log_journal_flush()
+{
+    if (!logfile_open)
+        return;
+
+    while (journal_count > 0)
+    {
+        JournalEntry_t *e = &journal[journal_tail];
+        uint8_t buf[sizeof(LogEvent_t) + LOG_EVENT_TEXT_MAX];
+
+        memcpy(buf, &e->evt, sizeof(e->evt));
+        memcpy(buf + sizeof(e->evt), e->text, e->len);
+
+        if (!log_put_rec(LOG_REC_EVENT, buf, sizeof(e->evt) + e->len))
+            return;
+
+        journal_tail = (journal_tail + 1) % LOG_JOURNAL_SIZE;
+        journal_count--;
+    }
+}
+
+// Takes as much PSRAM as is left for the whole flight capture and reports
+// its size and how fast blocks can be copied into it
+static void log_capture_init()
+{
+    if (!config.log_psram_en)
+        return;
+
+    if (external_psram_size == 0)
+    {
+        Serial1.println("MSG: NO PSRAM FITTED, WHOLE FLIGHT CAPTURE OFF");
+        return;
+    }
+
+    // Other EXTMEM users (pre-trigger window) come first, back off a MB at a time
+    for (uint32_t mb = external_psram_size; mb > 0 && !capture; mb--)
+    {
+        capture_blocks = (mb << 20) / LOG_BLOCK_SIZE;
+        capture = (uint8_t *)extmem_malloc(capture_blocks * LOG_BLOCK_SIZE);
+    }
+
+    if (!capture)
+    {
+        capture_blocks = 0;
+        Serial1.println("MSG: PSRAM ALLOCATION FAILED, WHOLE FLIGHT CAPTURE OFF");
+        return;
+    }
+
+    // 128 blocks, more than the data cache, so this measures the PSRAM itself
+    uint32_t t0 = ARM_DWT_CYCCNT;
+    for (uint32_t i = 0; i < 128; i++)
+        memcpy(&capture[i * LOG_BLOCK_SIZE], ring[i % LOG_RING_BLOCKS], LOG_BLOCK_SIZE);
+    uint32_t us = (ARM_DWT_CYCCNT - t0) / (F_CPU_ACTUAL / 1000000);
+
+    Serial1.printf("MSG: PSRAM CAPTURE %lu KB, COPY %lu KB/s\n", capture_blocks / 2,
+                   us ? 64UL * 1000000 / us : 0);
+}
+
 bool log_init()
 {
     if (sd_init())
@@ -35,6 +587,7 @@ bool log_init()
         if (logfile_init())
         {
             Serial1.println("MSG: LOG FILE CREATED");
+            log_capture_init();
         }
         else
         {
@@ -67,52 +620,734 @@ bool logfile_init()
     if (!sd_ready)
         return false;
 
-    char filename[32];
+    int num;
 
-    for (int i = 0; i < 1000; i++)
+    // Keep numbering continuous with the old JSON logs still on the card
+    for (num = 0; num < 1000; num++)
     {
-        snprintf(filename, sizeof(filename), "flightlog_%03d.json", i);
-        if (!sd.exists(filename))
+        snprintf(logfile_name, sizeof(logfile_name), "flightlog_%03d.json", num);
+        if (sd.exists(logfile_name))
+            continue;
+
+        snprintf(logfile_name, sizeof(logfile_name), "flightlog_%03d.bin", num);
+        if (!sd.exists(logfile_name))
             break;
     }
 
-    if (!logfile.open(filename, O_WRONLY | O_CREAT | O_EXCL))
+    if (!logfile.open(logfile_name, O_WRONLY | O_CREAT | O_EXCL))
     {
         logfile_open = false;
         return false;
     }
 
     logfile_open = true;
+    raw_mode = false;
+    prealloc = false;
+    file_end = 0;
+
+    // File number in the low bits, cycle counter above it. Card init time
+    // jitters by far more than a cycle, so a reused file number still gets
+    // a different id than the file whose sectors the extent may hold.
+    file_id = (ARM_DWT_CYCCNT << 10) | (uint32_t)num;
+
+    if (config.log_prealloc_mb > 0)
+    {
+        uint64_t len = (uint64_t)config.log_prealloc_mb << 20;
+
+        prealloc = logfile.preAllocate(len);
+        if (prealloc && logfile.contiguousRange(&raw_first_sector, &raw_last_sector))
+        {
+            // exFAT only tracks valid length through the file API, so it keeps
+            // using aligned logfile.write() calls into the preallocated extent
+            raw_mode = (sd.fatType() != FAT_TYPE_EXFAT);
+            Serial1.printf("MSG: LOG PREALLOCATED %lu MB%s\n", config.log_prealloc_mb, raw_mode ? " RAW" : "");
+        }
+        else
+        {
+            Serial1.println("MSG: LOG PREALLOCATION FAILED, APPENDING");
+        }
+    }
+
+    crc32_init();
 
-    logfile.println("[");
-    logfile.sync();
+    log_journal_flush(); // boot messages raised before the file existed
 
     return true;
 }
 
+// Full table, drops every other periodic entry and halves their rate. State
+// changes are always kept, they are what --state seeks to.
+static void log_index_thin()
+{
+    uint32_t n = 0;
+    uint8_t prev_state = 0xFF;
+    bool drop = false;
+
+    for (uint32_t i = 0; i < index_count; i++)
+    {
+        bool transition = index_tab[i].state != prev_state;
+        prev_state = index_tab[i].state;
+
+        if (!transition)
+        {
+            drop = !drop;
+            if (drop)
+                continue;
+        }
+        index_tab[n++] = index_tab[i];
+    }
+
+    index_count = n;
+    index_interval_ms *= 2;
+}
+
 bool log_write_frame(FltData_t *fltdata, FltStates_t state, uint32_t timestamp)
 {
     if (!logfile_open)
         return false;
 
-    char buf[512];
-    int len = serializer(buf, sizeof(buf), timestamp, state, fltdata);
+    uint8_t buf[sizeof(LogRecHdr_t) + LOG_DELTA_MAX];
+    size_t len = 0;
 
-    if (((len > 0) && ((size_t)len < sizeof(buf))))
+    bool index_now = (uint8_t)state != index_last_state || (timestamp - index_last_time) >= index_interval_ms;
+    if (index_now && index_count >= LOG_INDEX_MAX)
+        log_index_thin();
+    index_now = index_now && index_count < LOG_INDEX_MAX;
+
+    // Decoding can start at any index entry, so it gets a keyframe and
+    // fresh copies of the carried over values
+    uint32_t index_seq = block_seq;
+    if (index_now)
     {
-        logfile.print(buf);
-        logfile.println(",");
+        delta_need_key = true;
+        bias_logged = false;
+        if (baro_last.ts_us != 0)
+            log_put_rec(LOG_REC_BARO, &baro_last, sizeof(baro_last));
+    }
 
-        static uint32_t last_sync_time = 0;
+    // Bias only changes at calibration, log it then instead of in every frame
+    if (!bias_logged || memcmp(bias_last, fltdata->gyro_bias, sizeof(bias_last)) != 0)
+    {
+        LogBias_t bias;
+        bias.ts_us = micros();
+        memcpy(bias.gyro_bias, fltdata->gyro_bias, sizeof(bias.gyro_bias));
+        memcpy(bias_last, fltdata->gyro_bias, sizeof(bias_last));
+        bias_logged = log_put_rec(LOG_REC_BIAS, &bias, sizeof(bias));
+    }
+
+    bool quantized = true;
+    if (config.log_compress_en)
+    {
+        int32_t q[LOG_FRAME_FIELDS];
+        quantized = log_quantize(fltdata, q);
 
-        if (timestamp - last_sync_time > config.log_flush_interval_ms)
+        if (quantized && !delta_need_key && delta_count < LOG_KEYFRAME_INTERVAL && (uint8_t)state == delta_ref_state)
         {
-            logfile.sync();
-            last_sync_time = timestamp;
+            len = log_encode_delta(buf, timestamp, q);
+            delta_count++;
         }
 
-        return true;
+        memcpy(delta_ref, q, sizeof(delta_ref));
+        delta_ref_ts = timestamp;
+        delta_ref_state = (uint8_t)state;
+    }
+
+    // Keyframe, also used when a delta would not be any smaller
+    if (len == 0 || len >= sizeof(LogRecHdr_t) + sizeof(LogFrame_t))
+    {
+        len = log_encode_frame(buf, timestamp, state, fltdata);
+        delta_count = 0;
     }
 
+    // A lost frame breaks the delta chain, restart it with a keyframe
+    bool ok = log_put(buf, len);
+    delta_need_key = !ok || !config.log_compress_en || !quantized;
+
+    if (ok && index_now)
+    {
+        index_tab[index_count++] = {.seq = index_seq, .timestamp = timestamp, .state = (uint8_t)state};
+        index_last_time = timestamp;
+        index_last_state = (uint8_t)state;
+    }
+
+    return ok;
+}
+
+bool log_write_baro(const FltData_t *fltdata)
+{
+    baro_last.ts_us = micros();
+    baro_last.pressure = fltdata->pressure;
+    baro_last.altitude = fltdata->altitude;
+
+    if (!logfile_open)
+        return false;
+
+    return log_put_rec(LOG_REC_BARO, &baro_last, sizeof(baro_last));
+}
+
+void log_event(FltStates_t state, const char *fmt, ...)
+{
+    uint32_t now = micros(); // stamp before any formatting or printing
+    char text[128];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    Serial1.printf("MSG: %s\n", text);
+
+    if (journal_count >= LOG_JOURNAL_SIZE)
+    {
+        stats.events_dropped++;
+        return;
+    }
+
+    JournalEntry_t *e = &journal[(journal_tail + journal_count) % LOG_JOURNAL_SIZE];
+    e->evt.ts_us = now;
+    e->evt.state = (uint8_t)state;
+    e->len = (uint8_t)strnlen(text, LOG_EVENT_TEXT_MAX);
+    memcpy(e->text, text, e->len);
+    journal_count++;
+
+    log_journal_flush();
+}
+
+bool log_write_config(const char *text)
+{
+    if (!logfile_open)
+        return false;
+
+    return log_put_rec(LOG_REC_CONFIG, text, strnlen(text, 255));
+}
+
+static void log_lat_record(LogLatHist_t *h, uint32_t cycles)
+{
+    uint32_t us = cycles / (F_CPU_ACTUAL / 1000000);
+    int b = 31 - __builtin_clz(us | 1); // floor(log2(us))
+
+    if (b >= LOG_LAT_BUCKETS)
+        b = LOG_LAT_BUCKETS - 1;
+
+    if (h->count == 0 || us < h->min_us)
+        h->min_us = us;
+    if (us > h->max_us)
+        h->max_us = us;
+    h->count++;
+    h->bucket[b]++;
+}
+
+// Writes n blocks with consecutive sequence numbers through the file API.
+// Block seq always lands at seq * LOG_BLOCK_SIZE, so a block lost to a write
+// error leaves a hole instead of shifting every block after it.
+static bool log_file_write(const uint8_t *src, uint32_t seq, uint32_t n)
+{
+    static const uint8_t filler[LOG_BLOCK_SIZE] = {};
+    uint64_t pos = (uint64_t)seq * LOG_BLOCK_SIZE;
+
+    if (logfile.curPosition() != pos)
+    {
+        // The file ends short of pos after a failed write, zero fill the
+        // hole, readers skip it like any block without a valid header
+        uint64_t end = logfile.fileSize() / LOG_BLOCK_SIZE * LOG_BLOCK_SIZE;
+        if (!logfile.seekSet(pos < end ? pos : end))
+            return false;
+        while (logfile.curPosition() < pos)
+        {
+            if (logfile.write(filler, LOG_BLOCK_SIZE) != LOG_BLOCK_SIZE)
+                return false;
+        }
+    }
+
+    return logfile.write(src, n * LOG_BLOCK_SIZE) == n * LOG_BLOCK_SIZE;
+}
+
+// Writes n finished blocks with consecutive sequence numbers, src starts
+// with the header of the first one
+static bool log_write_sectors(const uint8_t *src, uint32_t n)
+{
+    LogBlockHdr_t hdr;
+    memcpy(&hdr, src, sizeof(hdr));
+
+    bool ok;
+    uint32_t sector = raw_first_sector + hdr.seq;
+
+    // Once the extent is used up, append through the file API like an
+    // unallocated file, which also brings back the periodic sync
+    if (raw_mode && sector + n - 1 > raw_last_sector)
+        raw_mode = false;
+
+    if (raw_mode)
+        ok = (n == 1) ? sd.card()->writeSector(sector, src) : sd.card()->writeSectors(sector, src, n);
+    else
+        ok = log_file_write(src, hdr.seq, n);
+
+    uint64_t end = (uint64_t)(hdr.seq + n) * LOG_BLOCK_SIZE;
+    if (ok && end > file_end)
+        file_end = end;
+
+    return ok;
+}
+
+static void log_finish_block(uint8_t *block)
+{
+    LogBlockHdr_t hdr;
+    memcpy(&hdr, block, sizeof(hdr));
+
+    uint32_t crc = crc32_update(0, block, offsetof(LogBlockHdr_t, crc));
+    hdr.crc = crc32_update(crc, block + sizeof(hdr), hdr.len);
+    memcpy(block, &hdr, sizeof(hdr));
+}
+
+static bool log_write_block(uint8_t *block)
+{
+    log_finish_block(block);
+
+    uint32_t t0 = ARM_DWT_CYCCNT;
+    bool ok = log_write_sectors(block, 1);
+    log_lat_record(&latency.write, ARM_DWT_CYCCNT - t0);
+
+    return ok;
+}
+
+bool log_write_imu(const ImuSample_t *smp, FltStates_t state)
+{
+    // Full rate only from ARM through recovery (and ground override), the
+    // pre-trigger window already covers the pad
+    // Gap counting restarts with every stretch of logged states
+    static uint32_t last_ts_us = 0;
+    if (!logfile_open || !config.log_imu_raw_en || state == STATE_DIAG || state == STATE_PREFLT)
+    {
+        last_ts_us = 0;
+        return false;
+    }
+
+    int32_t period_us = (int32_t)imu_period_us();
+    int32_t gap_us = (int32_t)(smp->ts_us - last_ts_us);
+
+    // More than 1.5 sample periods between reads means the loop missed one,
+    // a timestamp resync stepping back is not a gap
+    if (last_ts_us != 0 && gap_us > period_us * 3 / 2)
+        stats.imu_gaps += (gap_us + period_us / 2) / period_us - 1;
+    last_ts_us = smp->ts_us;
+
+    LogRecHdr_t hdr = {.type = LOG_REC_IMU, .len = sizeof(ImuSample_t)};
+    uint8_t buf[sizeof(LogRecHdr_t) + sizeof(ImuSample_t)];
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), smp, sizeof(ImuSample_t));
+
+    if (!log_put(buf, sizeof(buf)))
+    {
+        stats.imu_dropped++;
+        return false;
+    }
+
+    stats.imu_logged++;
+    return true;
+}
+
+void log_pretrig_push(const ImuSample_t *smp)
+{
+    if (pretrig_frozen)
+        return;
+
+    pretrig[pretrig_head] = *smp;
+    pretrig_head = (pretrig_head + 1) % LOG_PRETRIG_SAMPLES;
+
+    if (pretrig_count < LOG_PRETRIG_SAMPLES)
+        pretrig_count++;
+}
+
+void log_pretrig_dump()
+{
+    if (pretrig_frozen)
+        return;
+
+    pretrig_frozen = true;
+    pretrig_pending = pretrig_count;
+}
+
+// Moves frozen pre-trigger samples into the ring, oldest first. Only uses
+// the lower half of the ring so live frames always have room
+static void log_pretrig_drain()
+{
+    LogRecHdr_t hdr = {.type = LOG_REC_IMU, .len = sizeof(ImuSample_t)};
+    uint8_t buf[sizeof(LogRecHdr_t) + sizeof(ImuSample_t)];
+
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    for (int i = 0; i < PRETRIG_BURST && pretrig_pending > 0; i++)
+    {
+        if (ring_used() >= LOG_RING_BLOCKS / 2)
+            return;
+
+        uint32_t idx = (pretrig_head + LOG_PRETRIG_SAMPLES - pretrig_pending) % LOG_PRETRIG_SAMPLES;
+
+        memcpy(buf + sizeof(hdr), &pretrig[idx], sizeof(ImuSample_t));
+        if (!log_put(buf, sizeof(buf)))
+            return;
+
+        pretrig_pending--;
+    }
+}
+
+bool log_capture_start()
+{
+    if (!capture || capture_state != CAP_OFF)
+        return false;
+
+    capture_head = capture_tail = 0;
+    capture_state = CAP_RECORD;
+    return true;
+}
+
+void log_capture_flush()
+{
+    if (capture_state != CAP_RECORD)
+        return;
+
+    capture_state = CAP_FLUSH;
+    capture_flush_start = millis();
+    capture_flushed = 0;
+}
+
+// Moves sealed ring blocks into PSRAM, false once it is full
+static bool log_capture_fill()
+{
+    while (ring_tail != ring_head)
+    {
+        if (capture_head >= capture_blocks)
+            return false;
+
+        log_finish_block(ring[ring_tail]);
+        memcpy(&capture[capture_head * LOG_BLOCK_SIZE], ring[ring_tail], LOG_BLOCK_SIZE);
+
+        capture_head++;
+        ring_tail = (ring_tail + 1) % LOG_RING_BLOCKS;
+    }
+    return true;
+}
+
+// Writes up to CAPTURE_BURST captured blocks with a single card write
+static void log_capture_write()
+{
+    uint32_t n = capture_head - capture_tail;
+    if (n > CAPTURE_BURST)
+        n = CAPTURE_BURST;
+    if (n == 0)
+        return;
+
+    // Captured blocks were sealed back to back, so their sequence numbers
+    // are consecutive and a failed burst just leaves a hole of n blocks
+    uint32_t t0 = ARM_DWT_CYCCNT;
+    bool ok = log_write_sectors(&capture[capture_tail * LOG_BLOCK_SIZE], n);
+    log_lat_record(&latency.burst, ARM_DWT_CYCCNT - t0);
+
+    if (ok)
+        stats.blocks_written += n;
+    else
+        stats.write_errors++;
+
+    capture_tail += n;
+    capture_flushed += n;
+    if (capture_tail == capture_head)
+        capture_head = capture_tail = 0;
+}
+
+static bool log_capture_done()
+{
+    return capture_head == 0 && ring_tail == ring_head;
+}
+
+static void log_capture_end()
+{
+    capture_state = CAP_OFF;
+    uint32_t ms = millis() - capture_flush_start;
+    Serial1.printf("MSG: PSRAM CAPTURE FLUSHED, %lu KB IN %lu MS\n", capture_flushed / 2, ms);
+}
+
+static void log_capture_service()
+{
+    if (!log_capture_fill() && capture_state == CAP_RECORD)
+    {
+        // Out of PSRAM, touching the card in flight beats losing the rest of it
+        Serial1.println("MSG: PSRAM CAPTURE FULL, FLUSHING EARLY");
+        log_capture_flush();
+    }
+
+    if (capture_state != CAP_FLUSH)
+        return;
+
+    if (sd.card()->isBusy())
+    {
+        stats.stalls++;
+        return;
+    }
+
+    log_capture_write();
+
+    if (log_capture_done())
+        log_capture_end();
+}
+
+// Post landing only, waits on the card for every burst
+static void log_capture_drain_blocking()
+{
+    if (capture_state == CAP_RECORD)
+        log_capture_flush();
+
+    for (;;)
+    {
+        log_capture_fill();
+        if (log_capture_done())
+            break;
+        log_capture_write();
+    }
+    log_capture_end();
+}
+
+void log_service()
+{
+    if (!logfile_open)
+        return;
+
+    if (journal_count > 0)
+        log_journal_flush();
+
+    if (pretrig_pending > 0)
+        log_pretrig_drain();
+
+    // Bound how long a slow trickle of records can sit in RAM unprotected
+    if (fill_pos > sizeof(LogBlockHdr_t) && (millis() - head_open_time) >= config.log_flush_interval_ms &&
+        ring_used() < LOG_RING_BLOCKS - 1)
+        log_seal_block();
+
+    if (capture_state != CAP_OFF)
+    {
+        log_capture_service();
+        return;
+    }
+
+    static uint32_t last_sync_time = 0;
+    bool have_block = (ring_tail != ring_head);
+    bool want_sync = !raw_mode && (millis() - last_sync_time > config.log_flush_interval_ms);
+
+    if (!have_block && !want_sync)
+        return;
+
+    // Never wait on the card, try again after the next control tick
+    if (sd.card()->isBusy())
+    {
+        stats.stalls++;
+        return;
+    }
+
+    if (have_block)
+    {
+        // Retry a failed block on the next few ticks, then drop it so one bad
+        // write can't stall the ring for the rest of the flight
+        static uint8_t retries = 0;
+
+        if (log_write_block(ring[ring_tail]))
+            stats.blocks_written++;
+        else
+        {
+            stats.write_errors++;
+            if (++retries < LOG_WRITE_RETRIES)
+                return;
+        }
+
+        retries = 0;
+        ring_tail = (ring_tail + 1) % LOG_RING_BLOCKS;
+    }
+    else
+    {
+        uint32_t t0 = ARM_DWT_CYCCNT;
+        logfile.sync();
+        log_lat_record(&latency.sync, ARM_DWT_CYCCNT - t0);
+        last_sync_time = millis();
+    }
+}
+
+// Post landing only, waits on the card for every block
+static void log_drain_blocking()
+{
+    if (capture_state != CAP_OFF)
+        log_capture_drain_blocking();
+
+    while (ring_tail != ring_head)
+    {
+        if (log_write_block(ring[ring_tail]))
+            stats.blocks_written++;
+        else
+            stats.write_errors++;
+
+        ring_tail = (ring_tail + 1) % LOG_RING_BLOCKS;
+    }
+}
+
+// Writes the index footer, blocking on the card whenever the ring fills
+static void log_index_write()
+{
+    const uint32_t per_rec = 255 / sizeof(LogIndexEntry_t);
+    uint8_t buf[sizeof(LogRecHdr_t) + 255];
+
+    LogIndexEnd_t end = {.first_seq = block_seq, .entries = index_count};
+
+    for (uint32_t i = 0; i < index_count; i += per_rec)
+    {
+        uint32_t n = (index_count - i < per_rec) ? index_count - i : per_rec;
+        LogRecHdr_t hdr = {.type = LOG_REC_INDEX, .len = (uint8_t)(n * sizeof(LogIndexEntry_t))};
+
+        memcpy(buf, &hdr, sizeof(hdr));
+        memcpy(buf + sizeof(hdr), &index_tab[i], hdr.len);
+
+        if (!log_put(buf, sizeof(hdr) + hdr.len))
+        {
+            log_drain_blocking();
+            log_put(buf, sizeof(hdr) + hdr.len);
+        }
+    }
+
+    LogRecHdr_t hdr = {.type = LOG_REC_INDEX_END, .len = sizeof(LogIndexEnd_t)};
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), &end, sizeof(end));
+    log_put(buf, sizeof(hdr) + sizeof(end));
+}
+
+bool log_close()
+{
+    if (!logfile_open)
+        return false;
+
+    log_drain_blocking();
+
+    // Whatever of the pre-trigger window log_service() had not queued yet,
+    // half a ring at a time
+    while (pretrig_pending > 0)
+    {
+        log_pretrig_drain();
+        log_drain_blocking();
+    }
+
+    log_journal_flush();
+    log_drain_blocking();
+
+    // Ring is empty now so the footer always fits
+    LogRecHdr_t hdr = {.type = LOG_REC_STATS, .len = sizeof(LogStats_t)};
+    uint8_t buf[sizeof(LogRecHdr_t) + sizeof(LogStats_t)];
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), &stats, sizeof(LogStats_t));
+    log_put(buf, sizeof(buf));
+
+    log_put_rec(LOG_REC_LATENCY, &latency, offsetof(LogLatency_t, burst));
+    log_put_rec(LOG_REC_LATENCY_BURST, &latency.burst, sizeof(LogLatHist_t));
+
+    // Index starts on a fresh block so readers can seek straight to it
+    if (fill_pos > sizeof(LogBlockHdr_t))
+        log_seal_block();
+
+    log_index_write();
+
+    if (fill_pos > sizeof(LogBlockHdr_t))
+        log_seal_block();
+
+    log_drain_blocking();
+
+    // Give the unused part of the extent back to the filesystem. file_end
+    // rather than the block count, dropped blocks leave holes below it.
+    if (prealloc)
+        logfile.truncate(file_end);
+
+    logfile_open = false;
+
+    return logfile.close();
+}
+
+const LogStats_t *log_get_stats()
+{
+    return &stats;
+}
+
+const LogLatency_t *log_get_latency()
+{
+    return &latency;
+}
+
+uint32_t log_crc32(const uint8_t *data, size_t len)
+{
+    if (crc_table[1] == 0)
+        crc32_init();
+
+    return crc32_update(0, data, len);
+}
+
+// Only files logfile_init() creates can be listed or read
+static bool is_log_name(const char *name)
+{
+    return strncmp(name, "flightlog_", 10) == 0;
+}
+
+bool log_ls_begin()
+{
+    if (!sd_ready)
+        return false;
+
+    if (ls_dir.isOpen())
+        ls_dir.close();
+
+    return ls_dir.open("/", O_RDONLY);
+}
+
+bool log_ls_next(char *name, size_t len, uint32_t *size)
+{
+    FsFile f;
+
+    while (f.openNext(&ls_dir, O_RDONLY))
+    {
+        bool match = !f.isDir() && f.getName(name, len) > 0 && is_log_name(name);
+        *size = (uint32_t)f.fileSize();
+        f.close();
+
+        if (match)
+            return true;
+    }
+
+    ls_dir.close();
     return false;
-}
\ No newline at end of file
+}
+
+bool log_dl_open(const char *name, uint32_t *size)
+{
+    if (!sd_ready || !is_log_name(name))
+        return false;
+
+    // Still growing, and raw mode writes bypass the file, so reads would be stale
+    if (logfile_open && strcmp(name, logfile_name) == 0)
+        return false;
+
+    if (dl_file.isOpen())
+        dl_file.close();
+
+    if (!dl_file.open(name, O_RDONLY))
+        return false;
+
+    *size = (uint32_t)dl_file.fileSize();
+    return true;
+}
+
+int log_dl_read(uint32_t offset, uint8_t *buf, size_t len)
+{
+    if (!dl_file.isOpen() || !dl_file.seekSet(offset))
+        return -1;
+
+    return dl_file.read(buf, len);
+}
+
+void log_dl_close()
+{
+    if (dl_file.isOpen())
+        dl_file.close();
+}
@@ -16,7 +16,9 @@ FltStates_t state = STATE_DIAG; // Default startup to self test
 FltData_t fltdata;              // Init shared flight data struct
 
 uint32_t last_loop_time; // last flight loop run timestamp
+uint32_t last_smp_time;  // sensor timestamp of the newest IMU sample the loop ran on
 uint32_t burn_start;     // Ignition timestamp
+uint32_t recvy_start;    // Parachute deploy timestamp
 
 void setup()
 {
@@ -26,6 +28,7 @@ void setup()
 
   Serial.begin(0);      // USB ACM Serial, doesnt need baud rate
   Serial1.begin(38400); // Bluetooth serial
+  comms_init();         // Extra TX buffer for log downloads
 
   Wire.begin();
   Wire.setClock(I2C_SPEED_FMPLUS); // Use 1MHz fast mode plus I2C (IMU needs fast readout)
@@ -44,37 +47,37 @@ void setup()
   if (!imu_init())
     while (1)
       delay(1);
-  Serial1.println("MSG: IMU INIT SUCCESS");
+  log_event(state, "IMU INIT SUCCESS");
 
   if (!baro_init())
     while (1)
       delay(1);
-  Serial1.println("MSG: BARO INIT SUCCESS");
+  log_event(state, "BARO INIT SUCCESS");
 
   servo_init(&fltdata); // initialize and center servos in fltdata
 
-  Serial1.println("MSG: WILL TEST SERVO");
+  log_event(state, "WILL TEST SERVO");
 
   servo_swing_test();
 
-  Serial1.println("MSG: SERVO RECENTERED");
+  log_event(state, "SERVO RECENTERED");
 
-  Serial1.println("MSG: GYRO CAL IN 3 SEC");
-  delay(3000);
-  imu_cal_gyro(&fltdata); // gyro bias calibration, 500 smps averaged
+  if (config.test_mode_en)
+    log_event(state, "INVERTED TEST MODE ENABLED");
 
-  Serial1.println("MSG: BAYES READY");
+  log_event(state, "BAYES READY");
 
   nav_rst_integral(); // reset integral in all PID controllers
 
   state = STATE_PREFLT;
 
-  Serial1.println("MSG: The rocket knows where it is at all times.");
+  log_event(state, "The rocket knows where it is at all times.");
 
   if (config.test_mode_en == 0)
     digitalWrite(LED_BUILTIN, HIGH);
 
   last_loop_time = micros();
+  last_smp_time = last_loop_time;
 }
 
 void loop()
@@ -82,17 +85,39 @@ void loop()
   uint32_t current_time = micros();
   float dt = (current_time - last_loop_time) / 1000000.0f;
 
-  if (dt >= (1.0f / 1600.0f)) // 1600Hz
+  // Clocked by the IMU INT1 edge when enabled at init, so every tick starts at
+  // the same phase after a sample lands, otherwise polled at 1600Hz
+  bool tick = imu_irq_mode() ? imu_ready() : (dt >= (1.0f / 1600.0f));
+
+  if (tick)
   {
     last_loop_time = current_time;
 
-    if (imu_read(&fltdata))
+    uint16_t smp_count = imu_read(&fltdata);
+    if (smp_count > 0)
     {
+      const ImuSample_t *smps = imu_samples();
+      for (uint16_t i = 0; i < smp_count; i++)
+      {
+        log_pretrig_push(&smps[i]);
+        log_write_imu(&smps[i], state);
+      }
+
+      // Integrate over the sample spacing rather than the loop timing, ticks
+      // without new samples are skipped. A FIFO timestamp resync can step
+      // back or jump, then the nominal spacing stands in like imu_integrate()
+      float nominal = smp_count * imu_period_us() / 1000000.0f;
+      dt = (int32_t)(fltdata.imu_raw.ts_us - last_smp_time) / 1000000.0f;
+      if (dt <= 0.0f || dt > 4.0f * nominal)
+        dt = nominal;
+      last_smp_time = fltdata.imu_raw.ts_us;
+
       switch (state)
       {
 
       case STATE_PREFLT:
 
+        imu_bias_update(&fltdata); // gyro bias settles while the pad is still, frozen from ARM
         imu_calc_initial_att(&fltdata);
 
         break;
@@ -105,7 +130,8 @@ void loop()
         {
           state = STATE_BURN;
           burn_start = millis();
-          Serial1.println("MSG: LIFTOFF");
+          log_pretrig_dump(); // full rate ignition transient from the pre-trigger window
+          log_event(state, "LIFTOFF");
         }
         break;
 
@@ -119,7 +145,7 @@ void loop()
         if ((millis() - burn_start) >= config.motor_burn_time_ms)
         {
           state = STATE_COAST;
-          Serial1.println("MSG: BURN TIMER EXPIRED, UNLOCKING FINS");
+          log_event(state, "BURN TIMER EXPIRED, UNLOCKING FINS");
         }
 
         break;
@@ -132,13 +158,27 @@ void loop()
         if ((millis() - burn_start) >= config.parachute_charge_timeout_ms)
         {
           state = STATE_RECVY;
-          Serial1.println("MSG: PARACHUTE DELAY CHARGE TIMER EXPIRED, DISABLING CONTROL");
+          recvy_start = millis();
+          log_event(state, "PARACHUTE DELAY CHARGE TIMER EXPIRED, DISABLING CONTROL");
         }
 
         break;
 
       case STATE_RECVY:
         imu_calc_att(&fltdata, dt);
+
+        if ((millis() - recvy_start) >= config.log_psram_flush_delay_ms)
+          log_capture_flush(); // no-op unless a capture is running
+
+        // Once per boot, RECVY is left by rebooting only (flight lockout) and
+        // a boot without a log file halts in setup()
+        static bool log_closed = false;
+        if (!log_closed && (millis() - recvy_start) >= config.log_close_delay_ms)
+        {
+          log_closed = true;
+          if (log_close())
+            Serial1.println("MSG: LOG FILE CLOSED");
+        }
         break;
 
       case STATE_OVRD:
@@ -156,14 +196,16 @@ void loop()
       servo_write(&fltdata);
 
       static uint32_t last_baro_read = 0;
-      if ((current_time - last_baro_read) >= 15625)
+      if (baro_read(&fltdata)) // picks up the sample polled on an earlier tick
+        log_write_baro(&fltdata);
+      else if ((current_time - last_baro_read) >= 15625)
       {
-        baro_read(&fltdata);
+        baro_read_start();
         last_baro_read = current_time;
       }
 
       static uint32_t last_log_time = 0;
-      if ((millis() - last_log_time) >= config.log_interval_ms)
+      if ((millis() - last_log_time) >= config.log_rate_ms[state]) // 0 logs every tick
       {
         log_write_frame(&fltdata, state, millis());
         last_log_time = millis();
@@ -171,6 +213,8 @@ void loop()
 
       comms_send_telem(state, &fltdata);
     }
+
+    log_service(); // SD writes only happen in the slack after a control tick
   }
 
   comms_read_cmd(&state);